@@ -0,0 +1,136 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <linux/types.h>
+
+#include <rte_cycles.h>
+#include <rte_ether.h>
+#include <rte_ip.h>
+#include <rte_udp.h>
+
+#include "reflect.h"
+
+#define BENCH_PCKTS 1024
+#define BENCH_BURST 32
+
+// Roughly the size of a default mbuf's mempool element. A power of two stride would have every header alias the same cache sets.
+#define BENCH_PCKT_SIZE 2304
+
+#define DEFAULT_ROUNDS 10000
+
+/**
+ * Builds a UDP packet with random addresses and ports.
+ * 
+ * @param data A pointer to the packet's buffer.
+ * @param options Whether to add IPv4 options (which make the kernels take their slower path).
+ * @param iph A pointer to store the IPv4 header's address in.
+ * @param l4h A pointer to store the UDP header's address in.
+ * 
+ * @return Void
+**/
+static void build_pckt(__u8 *data, int options, struct rte_ipv4_hdr **iph, void **l4h)
+{
+    unsigned ihl = options ? 8 : 5;
+    unsigned i;
+
+    for (i = 0; i < 64; i++)
+    {
+        data[i] = rand() & 0xFF;
+    }
+
+    ((struct rte_ether_hdr *)data)->ether_type = rte_cpu_to_be_16(RTE_ETHER_TYPE_IPV4);
+
+    *iph = (struct rte_ipv4_hdr *)(data + sizeof(struct rte_ether_hdr));
+    (*iph)->version_ihl = 0x40 | ihl;
+    (*iph)->next_proto_id = IPPROTO_UDP;
+
+    *l4h = (__u8 *)*iph + ihl * 4;
+}
+
+/**
+ * The main function call. Times every kernel the CPU supports against the scalar one over bursts of packets spread across separate buffers (like mbufs).
+ * 
+ * @param argc The amount of arguments.
+ * @param argv A pointer to the arguments array (the optional first argument is the amount of rounds over all packets and the second the percentage of packets with IPv4 options).
+ * 
+ * @return Return code.
+**/
+int main(int argc, char **argv)
+{
+    unsigned long rounds = (argc > 1) ? strtoul(argv[1], NULL, 0) : DEFAULT_ROUNDS;
+    unsigned options_pct = (argc > 2) ? strtoul(argv[2], NULL, 0) : 0;
+
+    static struct rte_ether_hdr *eths[BENCH_PCKTS];
+    static struct rte_ipv4_hdr *iphs[BENCH_PCKTS];
+    static void *l4hs[BENCH_PCKTS];
+
+    __u8 *pool = aligned_alloc(64, BENCH_PCKTS * BENCH_PCKT_SIZE);
+
+    if (pool == NULL)
+    {
+        fprintf(stderr, "Failed to allocate packet buffers.\n");
+
+        return EXIT_FAILURE;
+    }
+
+    unsigned i;
+
+    srand(1);
+
+    for (i = 0; i < BENCH_PCKTS; i++)
+    {
+        __u8 *data = pool + i * BENCH_PCKT_SIZE;
+
+        eths[i] = (struct rte_ether_hdr *)data;
+
+        build_pckt(data, (unsigned)(rand() % 100) < options_pct, &iphs[i], &l4hs[i]);
+    }
+
+    printf("Reflecting %u packets in bursts of %u, %lu rounds (%u%% with IPv4 options).\n", BENCH_PCKTS, BENCH_BURST, rounds, options_pct);
+
+    double scalar_cpp = 0;
+    int kernel;
+
+    for (kernel = REFLECT_SCALAR; kernel < REFLECT_MAX_KERNEL; kernel++)
+    {
+        if (reflect_select(kernel) != 0)
+        {
+            printf("%-8s => not supported by this CPU.\n", reflect_kernel_name(kernel));
+
+            continue;
+        }
+
+        unsigned long r;
+
+        // Warm up the caches.
+        for (i = 0; i < BENCH_PCKTS; i += BENCH_BURST)
+        {
+            reflect_burst(&eths[i], &iphs[i], &l4hs[i], BENCH_BURST);
+        }
+
+        __u64 start = rte_rdtsc();
+
+        for (r = 0; r < rounds; r++)
+        {
+            for (i = 0; i < BENCH_PCKTS; i += BENCH_BURST)
+            {
+                reflect_burst(&eths[i], &iphs[i], &l4hs[i], BENCH_BURST);
+            }
+        }
+
+        __u64 cycles = rte_rdtsc() - start;
+
+        double cpp = (double)cycles / ((double)rounds * BENCH_PCKTS);
+
+        if (kernel == REFLECT_SCALAR)
+        {
+            scalar_cpp = cpp;
+        }
+
+        printf("%-8s => %.2f cycles per packet (%.2fx scalar).\n", reflect_kernel_name(kernel), cpp, scalar_cpp / cpp);
+    }
+
+    free(pool);
+
+    return 0;
+}
@@ -0,0 +1,136 @@
+#ifndef BLOOM_HEADER
+#define BLOOM_HEADER
+
+#include <string.h>
+#include <linux/types.h>
+
+#include <rte_common.h>
+#include <rte_malloc.h>
+
+// A blocked bloom filter of cache lines. Every key sets three bits within a single cache line, so a test is one cache line read.
+#define BLOOM_WORDS_PER_LINE 8
+#define BLOOM_BITS_PER_LINE (BLOOM_WORDS_PER_LINE * 64)
+
+// The filter is sized for this many bits per key, which keeps the false positive rate with three bits per key at around 1%.
+#define BLOOM_BITS_PER_KEY 12
+
+// The filter's size ranges from 64 cache lines (4 KB) to 8192 cache lines (512 KB, so it stays within L2). Filters that would need to be larger are never built, since they'd either cost a cache miss per test or let most keys through.
+#define BLOOM_MIN_LINE_BITS 6
+#define BLOOM_MAX_LINE_BITS 13
+#define BLOOM_MAX_KEYS (((__u64)1 << BLOOM_MAX_LINE_BITS) * BLOOM_BITS_PER_LINE / BLOOM_BITS_PER_KEY)
+
+struct bloom
+{
+    __u64 (*lines)[BLOOM_WORDS_PER_LINE];
+
+    // The amount of lines is a power of two, so the upper bits of a key's hash select its line.
+    unsigned line_bits;
+};
+
+/**
+ * Hashes a 32-bit key. The upper bits select the cache line and the lower 27 bits the three bits within it.
+ * 
+ * @param key The key.
+ * 
+ * @return The 64-bit hash.
+**/
+static inline __u64 bloom_hash(__u32 key)
+{
+    __u64 h = (__u64)key * 0x9E3779B97F4A7C15ULL;
+
+    return h ^ (h >> 29);
+}
+
+/**
+ * Allocates a bloom filter sized for the amount of keys it'll hold.
+ * 
+ * @param bf A pointer to the bloom filter.
+ * @param nb_keys The amount of keys that will be added.
+ * 
+ * @return 0 on success or -1 if there are more than BLOOM_MAX_KEYS keys or the filter couldn't be allocated.
+**/
+static inline int bloom_create(struct bloom *bf, __u64 nb_keys)
+{
+    bf->lines = NULL;
+    bf->line_bits = BLOOM_MIN_LINE_BITS;
+
+    if (nb_keys > BLOOM_MAX_KEYS)
+    {
+        return -1;
+    }
+
+    __u64 nb_lines = (nb_keys * BLOOM_BITS_PER_KEY + BLOOM_BITS_PER_LINE - 1) / BLOOM_BITS_PER_LINE;
+
+    while (((__u64)1 << bf->line_bits) < nb_lines)
+    {
+        bf->line_bits++;
+    }
+
+    bf->lines = rte_zmalloc("bloom", ((size_t)1 << bf->line_bits) * sizeof(*bf->lines), RTE_CACHE_LINE_SIZE);
+
+    return (bf->lines != NULL) ? 0 : -1;
+}
+
+/**
+ * Frees a bloom filter's lines.
+ * 
+ * @param bf A pointer to the bloom filter.
+ * 
+ * @return Void
+**/
+static inline void bloom_free(struct bloom *bf)
+{
+    rte_free(bf->lines);
+
+    bf->lines = NULL;
+}
+
+/**
+ * Adds a key to a bloom filter.
+ * 
+ * @param bf A pointer to the bloom filter.
+ * @param key The key.
+ * 
+ * @return Void
+**/
+static inline void bloom_add(struct bloom *bf, __u32 key)
+{
+    __u64 h = bloom_hash(key);
+    __u64 *line = bf->lines[h >> (64 - bf->line_bits)];
+    unsigned i;
+
+    for (i = 0; i < 3; i++)
+    {
+        unsigned bit = (h >> (i * 9)) & 511;
+
+        line[bit >> 6] |= 1ULL << (bit & 63);
+    }
+}
+
+/**
+ * Tests whether a key may be within a bloom filter. There are no false negatives, so a miss means the key was never added.
+ * 
+ * @param bf A pointer to the bloom filter.
+ * @param key The key.
+ * 
+ * @return 1 if the key may have been added or 0 if it definitely wasn't.
+**/
+static inline int bloom_test(const struct bloom *bf, __u32 key)
+{
+    __u64 h = bloom_hash(key);
+    const __u64 *line = bf->lines[h >> (64 - bf->line_bits)];
+    unsigned i;
+
+    for (i = 0; i < 3; i++)
+    {
+        unsigned bit = (h >> (i * 9)) & 511;
+
+        if (!(line[bit >> 6] & (1ULL << (bit & 63))))
+        {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+#endif
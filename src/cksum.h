@@ -0,0 +1,114 @@
+#ifndef CKSUM_HEADER
+#define CKSUM_HEADER
+
+#include <string.h>
+#include <linux/types.h>
+
+#include <rte_byteorder.h>
+#include <rte_ip.h>
+
+/**
+ * Incrementally updates a one's complement checksum after a 16-bit word of the covered data changed (RFC 1624, eqn. 3: HC' = ~(~HC + ~m + m')).
+ * 
+ * All values must use the same byte order, the one's complement sum is byte order independent.
+ * 
+ * @param cksum The current checksum.
+ * @param old The old value of the 16-bit word.
+ * @param new The new value of the 16-bit word.
+ * 
+ * @return The updated checksum.
+**/
+static inline __u16 cksum_update16(__u16 cksum, __u16 old, __u16 new)
+{
+    __u32 sum = (__u16)~cksum + (__u16)~old + new;
+
+    // Fold the carries back in (at most two folds are needed for three 16-bit words).
+    sum = (sum & 0xFFFF) + (sum >> 16);
+    sum = (sum & 0xFFFF) + (sum >> 16);
+
+    return (__u16)~sum;
+}
+
+/**
+ * Decrements the TTL of an IPv4 header and incrementally updates its header checksum. The caller must make sure the TTL is above one.
+ * 
+ * @param iph A pointer to the IPv4 header.
+ * 
+ * @return Void
+**/
+static inline void ipv4_ttl_dec(struct rte_ipv4_hdr *iph)
+{
+    // The TTL shares its 16-bit word with the protocol.
+    __u16 old;
+    __u16 new;
+
+    memcpy(&old, &iph->time_to_live, sizeof(old));
+
+    iph->time_to_live--;
+
+    memcpy(&new, &iph->time_to_live, sizeof(new));
+
+    iph->hdr_checksum = cksum_update16(iph->hdr_checksum, old, new);
+}
+
+/**
+ * Sets the DSCP of an IPv4 header (keeping its ECN bits) and incrementally updates its header checksum.
+ * 
+ * @param iph A pointer to the IPv4 header.
+ * @param dscp The DSCP (0 - 63).
+ * 
+ * @return Void
+**/
+static inline void ipv4_set_dscp(struct rte_ipv4_hdr *iph, __u8 dscp)
+{
+    // The type of service shares its 16-bit word with the version and header length.
+    __u16 old;
+    __u16 new;
+
+    memcpy(&old, &iph->version_ihl, sizeof(old));
+
+    iph->type_of_service = (dscp << 2) | (iph->type_of_service & 0x03);
+
+    memcpy(&new, &iph->version_ihl, sizeof(new));
+
+    iph->hdr_checksum = cksum_update16(iph->hdr_checksum, old, new);
+}
+
+/**
+ * Decrements the TTL of a burst of IPv4 headers and incrementally updates their header checksums. The caller must make sure each TTL is above one.
+ * 
+ * Decrementing the TTL always lowers the TTL/protocol word by 0x0100, so ~m + m' is the constant -0x0100 (0xFEFF) and the checksums can be computed over a dense array without branches (which the compiler vectorizes).
+ * 
+ * @param iphs A pointer to the array of IPv4 headers.
+ * @param nb The amount of headers.
+ * 
+ * @return Void
+**/
+static inline void ipv4_ttl_dec_burst(struct rte_ipv4_hdr **iphs, unsigned nb)
+{
+    const __u32 delta = RTE_BE16(0xFEFF);
+    __u32 sums[nb];
+    unsigned i;
+
+    // Gather the checksums.
+    for (i = 0; i < nb; i++)
+    {
+        sums[i] = iphs[i]->hdr_checksum;
+    }
+
+    // HC' = ~(~HC + 0xFEFF) with a single fold (the sum never exceeds 0x1FFFE).
+    for (i = 0; i < nb; i++)
+    {
+        __u32 sum = ((~sums[i]) & 0xFFFF) + delta;
+
+        sums[i] = ~((sum & 0xFFFF) + (sum >> 16)) & 0xFFFF;
+    }
+
+    // Scatter the checksums and TTLs back.
+    for (i = 0; i < nb; i++)
+    {
+        iphs[i]->hdr_checksum = (__u16)sums[i];
+        iphs[i]->time_to_live--;
+    }
+}
+#endif
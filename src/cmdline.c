@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <string.h>
 #include <getopt.h>
 
 #include <dpdk_common.h>
@@ -17,12 +18,29 @@ int parsecmdline(struct cmdline *cmd, int argc, char **argv)
         {"queues", required_argument, NULL, 'q'},
         {"promisc", no_argument, NULL, 'x'},
         {"stats", no_argument, NULL, 's'},
+        {"hwmeta", no_argument, NULL, 'm'},
         {"pps", required_argument, NULL, 1},
         {"bps", required_argument, NULL, 2},
+        {"filters", required_argument, NULL, 3},
+        {"bpf", required_argument, NULL, 4},
+        {"ports", required_argument, NULL, 5},
+        {"pps-burst", required_argument, NULL, 6},
+        {"bps-burst", required_argument, NULL, 7},
+        {"meter", required_argument, NULL, 8},
+        {"cir", required_argument, NULL, 9},
+        {"cbs", required_argument, NULL, 10},
+        {"ebs", required_argument, NULL, 11},
+        {"pir", required_argument, NULL, 12},
+        {"pbs", required_argument, NULL, 13},
+        {"yellow-dscp", required_argument, NULL, 14},
+        {"pps24", required_argument, NULL, 15},
+        {"bps24", required_argument, NULL, 16},
+        {"pps16", required_argument, NULL, 17},
+        {"bps16", required_argument, NULL, 18},
         {NULL, 0, NULL, 0}
     };
 
-    while ((c = getopt_long(argc, argv, "p:P:q:xs", lopts, NULL)) != EOF)
+    while ((c = getopt_long(argc, argv, "p:P:q:xsm", lopts, NULL)) != EOF)
     {
         switch (c)
         {
@@ -65,6 +83,11 @@ int parsecmdline(struct cmdline *cmd, int argc, char **argv)
 
                 break;
 
+            case 'm':
+                cmd->hwmeta = 1;
+
+                break;
+
             /* For rate limit application */
             case 1:
             {
@@ -81,6 +104,107 @@ int parsecmdline(struct cmdline *cmd, int argc, char **argv)
 
                 break;
             }
+
+            case 6:
+                cmd->pps_burst = strtoull(optarg, NULL, 0);
+
+                break;
+
+            case 7:
+                cmd->bps_burst = strtoull(optarg, NULL, 0);
+
+                break;
+
+            case 8:
+                if (strcmp(optarg, "srtcm") == 0)
+                {
+                    cmd->meter = CMDLINE_METER_SRTCM;
+                }
+                else if (strcmp(optarg, "trtcm") == 0)
+                {
+                    cmd->meter = CMDLINE_METER_TRTCM;
+                }
+                else
+                {
+                    rte_exit(EXIT_FAILURE, "Invalid meter with --meter (srtcm or trtcm).\n");
+                }
+
+                break;
+
+            case 9:
+                cmd->cir = strtoull(optarg, NULL, 0);
+
+                break;
+
+            case 10:
+                cmd->cbs = strtoull(optarg, NULL, 0);
+
+                break;
+
+            case 11:
+                cmd->ebs = strtoull(optarg, NULL, 0);
+
+                break;
+
+            case 12:
+                cmd->pir = strtoull(optarg, NULL, 0);
+
+                break;
+
+            case 13:
+                cmd->pbs = strtoull(optarg, NULL, 0);
+
+                break;
+
+            case 14:
+            {
+                unsigned long dscp = strtoul(optarg, NULL, 0);
+
+                if (dscp > 63)
+                {
+                    rte_exit(EXIT_FAILURE, "Invalid DSCP with --yellow-dscp (0 - 63).\n");
+                }
+
+                cmd->yellow_dscp = (__u8)dscp;
+
+                break;
+            }
+
+            case 15:
+                cmd->pps24 = strtoull(optarg, NULL, 0);
+
+                break;
+
+            case 16:
+                cmd->bps24 = strtoull(optarg, NULL, 0);
+
+                break;
+
+            case 17:
+                cmd->pps16 = strtoull(optarg, NULL, 0);
+
+                break;
+
+            case 18:
+                cmd->bps16 = strtoull(optarg, NULL, 0);
+
+                break;
+
+            /* For drop UDP port 8080 application */
+            case 3:
+                cmd->filters = optarg;
+
+                break;
+
+            case 4:
+                cmd->bpf = optarg;
+
+                break;
+
+            case 5:
+                cmd->ports = optarg;
+
+                break;
             
             case '?':
                 fprintf(stdout, "Missing argument.\n");
@@ -3,15 +3,41 @@
 
 #include <linux/types.h>
 
+// Rate limit metering modes.
+#define CMDLINE_METER_NONE 0
+#define CMDLINE_METER_SRTCM 1
+#define CMDLINE_METER_TRTCM 2
+
 struct cmdline
 {
     __u16 queues;
     unsigned int promisc : 1;
     unsigned int stats : 1;
+    unsigned int hwmeta : 1;
+
+    /* For drop UDP port 8080 application. */
+    const char *filters;
+    const char *bpf;
+    const char *ports;
 
     /* For rate limit application. */
     __u64 pps;
     __u64 bps;
+    __u64 pps_burst;
+    __u64 bps_burst;
+
+    __u8 meter;
+    __u64 cir;
+    __u64 cbs;
+    __u64 ebs;
+    __u64 pir;
+    __u64 pbs;
+    __u8 yellow_dscp;
+
+    __u64 pps24;
+    __u64 bps24;
+    __u64 pps16;
+    __u64 bps16;
 };
 
 int parsecmdline(struct cmdline *cmd, int argc, char **argv);
@@ -14,173 +14,70 @@
 #include <dpdk_common.h>
 #include <rte_ip.h>
 #include <rte_udp.h>
+#include <rte_rcu_qsbr.h>
+#include <rte_thread.h>
+#include <rte_version.h>
 
 #include "cmdline.h"
+#include "queues.h"
+#include "stats.h"
+#include "parse.h"
+#include "reflect.h"
+#include "filters.h"
 
 /* Helpful defines */
 #ifndef htons
 #define htons(o) cpu_to_be16(o)
 #endif
 
-#define ETH_P_IP 0x0800
-#define ETH_P_8021Q	0x8100
+#define PROTOCOL_TCP 0x06
 #define PROTOCOL_UDP 0x11
 
-//#define DEBUG
+// How often the reload thread checks for a pending reload.
+#define RELOAD_CHECK_US 100000
 
-__u64 pckts_forwarded = 0;
-__u64 pckts_dropped = 0;
+//#define DEBUG
 
-/**
- * Swaps the source and destination ethernet MAC addresses.
- * 
- * @param eth A pointer to the ethernet header (struct rte_ether_hdr).
- * 
- * @return Void
-**/
-static void swap_eth(struct rte_ether_hdr *eth)
-{
-    struct rte_ether_addr tmp;
-    rte_ether_addr_copy(&eth->src_addr, &tmp);
+// The filter rules currently used by the l-cores. This is only ever replaced as a whole and the old rules are freed once all l-cores went through a quiescent state.
+struct filters *cur_filters = NULL;
 
-    rte_ether_addr_copy(&eth->dst_addr, &eth->src_addr);
-    rte_ether_addr_copy(&tmp, &eth->dst_addr);
-}
+// Quiescent state based reclamation variable the l-cores report to after each loop iteration.
+struct rte_rcu_qsbr *filters_rcu = NULL;
 
-/**
- * Swaps the source and destination IP addresses.
- * 
- * @param iph A pointer to the IPv4 header (struct rte_ipv4_hdr).
- * 
- * @return Void
-**/
-static void swap_iph(struct rte_ipv4_hdr *iph)
-{
-    rte_be32_t tmp;
-    memcpy(&tmp, &iph->src_addr, sizeof(tmp));
+// Set by SIGHUP to request a filters file reload.
+volatile int reload = 0;
 
-    memcpy(&iph->src_addr, &iph->dst_addr, sizeof(iph->src_addr));
-    memcpy(&iph->dst_addr, &tmp, sizeof(iph->dst_addr));
-}
+struct cmdline cmd = {0};
 
 /**
- * Swaps the source and destination UDP ports.
- * 
- * @param udph A pointer to the UDP header (struct rte_udp_hdr).
- * 
- * @return Void
-**/
-static void swap_udph(struct rte_udp_hdr *udph)
-{
-    rte_be16_t tmp;
-    memcpy(&tmp, &udph->src_port, sizeof(tmp));
-
-    memcpy(&udph->src_port, &udph->dst_port, sizeof(udph->src_port));
-    memcpy(&udph->dst_port, &tmp, sizeof(udph->dst_port));
-}
-
-/**
- * Inspects a packet and checks against UDP destination port 8080.
+ * Inspects a packet with the action the filter rules classified it with. Only the parsed metadata is looked at, the packet's headers aren't read again.
  * 
  * @param pckt A pointer to the rte_mbuf container the packet data.
- * @param portid The port ID we're inspecting from.
+ * @param meta A pointer to the parsed metadata of the packet's burst.
+ * @param idx The packet's index within the burst.
+ * @param action The packet's filters action.
+ * @param st A pointer to the l-core's stats block.
  * 
- * @return Void
+ * @return 1 if the packet should be reflected or 0 if it was dropped (and freed).
 **/
-static void inspect_pckt(struct rte_mbuf *pckt, unsigned port_id)
+static int inspect_pckt(struct rte_mbuf *pckt, const struct parse_meta *meta, unsigned idx, __u32 action, struct lcore_stats *st)
 {
-    // Data points to the start of packet data within the mbuf.
-    void *data = pckt->buf_addr + pckt->data_off;
-
-    // The offset.
-    unsigned int offset = 0;
-
-    // Initialize ethernet header.
-    struct rte_ether_hdr *eth = data;
-
-    offset += sizeof(struct rte_ether_hdr);
-
-    // Make sure we're dealing with IPv4 or a VLAN.
-    if (eth->ether_type != htons(ETH_P_IP) && eth->ether_type != htons(ETH_P_8021Q))
-    {
-        rte_pktmbuf_free(pckt);
-
-        return;
-    }
-
-    // Handle VLAN.
-    if (eth->ether_type == htons(ETH_P_8021Q))
-    {
-        // VLAN header length is four bytes, so increase offset by that amount.
-        offset += 4;
-    }
-
-    // Initialize IPv4 header.
-    struct rte_ipv4_hdr *iph = data + offset;
-
-    // Check to make sure we're dealing with UDP.
-    if (iph->next_proto_id != PROTOCOL_UDP)
-    {
-        rte_pktmbuf_free(pckt);
-
-        return;
-    }
-
-    // Increase offset by length of IPv4 header.
-    offset += (iph->ihl * 4);
-
-    // Initialize UDP header.
-    struct rte_udp_hdr *udph = data + offset;
-
-    // Check destination port.
-    if (udph->dst_port == htons(8080))
+    if (action == FILTERS_DROP)
     {
         rte_pktmbuf_free(pckt);
 
         // Increment packets dropped count.
-        pckts_dropped++;
+        stats_drop(st, DROP_FILTER);
 
         // Drop packet.
-        return;
+        return 0;
     }
 
 #ifdef DEBUG
-    printf("[IN] Src MAC => " RTE_ETHER_ADDR_PRT_FMT ". Dst MAC => " RTE_ETHER_ADDR_PRT_FMT ". Source IP => %u. Dest IP => %u. Source port => %d. Dest port => %d.\n", RTE_ETHER_ADDR_BYTES(&eth->src_addr), RTE_ETHER_ADDR_BYTES(&eth->dst_addr), iph->src_addr, iph->dst_addr, htons(udph->src_port), htons(udph->dst_port));
+    printf("[IN] Source IP => %u. Dest IP => %u. Source port => %d. Dest port => %d.\n", meta->src_ip[idx], meta->dst_ip[idx], htons(meta->src_port[idx]), htons(meta->dst_port[idx]));
 #endif
 
-    // Swap MAC addresses.
-    swap_eth(eth);
-
-    // Swap IP addresses.
-    swap_iph(iph);
-
-    // Swap UDP ports.
-    swap_udph(udph);
-
-    // Recalculate IP header checksum.
-    iph->hdr_checksum = 0;
-    rte_ipv4_cksum(iph);
-
-    // Recalulate UDP header checksum.
-    udph->dgram_cksum = 0;
-    rte_ipv4_udptcp_cksum(iph, udph);
-
-#ifdef DEBUG
-    printf("[OUT] Src MAC => " RTE_ETHER_ADDR_PRT_FMT ". Dst MAC => " RTE_ETHER_ADDR_PRT_FMT ". Source IP => %u. Dest IP => %u. Source port => %d. Dest port => %d.\n", RTE_ETHER_ADDR_BYTES(&eth->src_addr), RTE_ETHER_ADDR_BYTES(&eth->dst_addr), iph->src_addr, iph->dst_addr, htons(udph->src_port), htons(udph->dst_port));
-#endif
-
-    // Otherwise, forward packet.
-    unsigned dst_port;
-    struct rte_eth_dev_tx_buffer *buffer;
-
-    // Retrieve what port we're going out of and TX buffer to use.
-    dst_port = ports[port_id].tx_port;
-    buffer = ports[dst_port].tx_buffer;
-    
-    rte_eth_tx_buffer(dst_port, 0, buffer, pckt);
-
-    // Increment packets TX count.
-    pckts_forwarded++;
+    return 1;
 }
 
 /**
@@ -191,10 +88,22 @@ static void inspect_pckt(struct rte_mbuf *pckt, unsigned port_id)
 static void pckt_loop(void)
 {
     // An array of packets witin burst.
-    struct rte_mbuf *pckts_burst[packet_burst_size];
+    struct rte_mbuf *pckts_burst[PARSE_MAX_BURST];
+
+    // The parsed headers of the burst.
+    struct parse_meta meta;
+
+    // The IPv4 packets of the burst to classify.
+    struct filters_burst fb;
+
+    // The port list lookup results of the burst.
+    __u64 port_hits[PORTMAP_HITS_WORDS];
+
+    // The packets of the burst to send back.
+    struct reflect_list refl;
 
-    // Single mbuf we'll use to inspect.
-    struct rte_mbuf *pckt;
+    // The parser handles at most PARSE_MAX_BURST packets at once.
+    const unsigned burst_size = RTE_MIN(packet_burst_size, PARSE_MAX_BURST);
 
     // Retrieve the l-core ID.
     unsigned lcore_id = rte_lcore_id();
@@ -207,22 +116,25 @@ static void pckt_loop(void)
     unsigned port_id;
     unsigned nb_rx;
 
-    // The specific RX queue config for the l-core.
-    struct lcore_port_conf *qconf = &lcore_port_conf[lcore_id];
+    // The specific RX/TX queue config for the l-core.
+    struct lcore_queue_conf *qconf = &lcore_queue_conf[lcore_id];
+
+    // The l-core's own counters.
+    struct lcore_stats *st = &lcore_stats[lcore_id];
 
     // For TX draining.
     const __u64 draintsc = (rte_get_tsc_hz() + US_PER_S - 1) / US_PER_S * BURST_TX_DRAIN_US;
 
-    // Pointer to TX buffer.
-    struct rte_eth_dev_tx_buffer *buffer;
-
     // Create timer variables.
     __u64 prevtsc = 0;
     __u64 difftsc;
     __u64 curtsc;
 
+    // Whether to trust the NIC's packet types (hardware metadata mode).
+    const unsigned use_ptype = cmd.hwmeta;
+
     // If we have no RX ports under this l-core, return because the l-core has nothing else to do.
-    if (qconf->num_rx_ports == 0)
+    if (qconf->num_rx_queues == 0)
     {
         RTE_LOG(INFO, USER1, "lcore %u has nothing to do.\n", lcore_id);
 
@@ -230,11 +142,18 @@ static void pckt_loop(void)
     }
 
     // Log message.
-    RTE_LOG(INFO, USER1, "Looping lcore %u with %u RX ports/queues.\n", lcore_id, qconf->num_rx_ports);
+    RTE_LOG(INFO, USER1, "Looping lcore %u with %u RX queues (TX queue %u).\n", lcore_id, qconf->num_rx_queues, qconf->tx_queue_id);
+
+    // Register with the filters' RCU variable so reloads wait on us before freeing the old rules.
+    rte_rcu_qsbr_thread_register(filters_rcu, lcore_id);
+    rte_rcu_qsbr_thread_online(filters_rcu, lcore_id);
 
     // Create while loop relying on quit variable.
     while (!quit)
     {
+        // Retrieve the current rules. This is a single load, we never take a lock on the datapath.
+        const struct filters *flt = __atomic_load_n(&cur_filters, __ATOMIC_ACQUIRE);
+
         // Get current timestamp.
         curtsc = rte_rdtsc();
 
@@ -244,18 +163,12 @@ static void pckt_loop(void)
         // Check if we need to send packets out the buffer.
         if (unlikely(difftsc > draintsc))
         {
-            // Loop through all TX ports.
+            // Loop through all TX ports and send packets in our own buffer out our own TX queue.
             for (i = 0; i < qconf->num_tx_ports; i++)
             {
-                // Retrieve correct port_id and buffer.
-                port_id = ports[qconf->rx_port_list[i]].tx_port;
-                buffer = ports[port_id].tx_buffer;
+                port_id = qconf->tx_port_list[i];
 
-                // Loop through each TX queue and send packets in buffer.
-                for (j = 0; j < tx_queue_pp; j++)
-                {
-                    rte_eth_tx_buffer_flush(port_id, j, buffer);
-                }
+                rte_eth_tx_buffer_flush(port_id, qconf->tx_queue_id, qconf->tx_buffers[port_id]);
             }
 
             // Assign prevtsc.
@@ -263,28 +176,91 @@ static void pckt_loop(void)
         }
 
         // Read all packets from RX queue.
-        for (i = 0; i < qconf->num_rx_ports; i++)
+        for (i = 0; i < qconf->num_rx_queues; i++)
         {
             // Retrieve correct port ID.
-            port_id = qconf->rx_port_list[i];
+            port_id = qconf->rx_queues[i].port_id;
 
             // Burst RX which will assign nb_rx to the amount of packets we have from the RX queue.
-            nb_rx = rte_eth_rx_burst(port_id, 0, pckts_burst, packet_burst_size);
+            nb_rx = rte_eth_rx_burst(port_id, qconf->rx_queues[i].queue_id, pckts_burst, burst_size);
+
+            // Parse the headers of the whole burst at once.
+            parse_burst(pckts_burst, nb_rx, &meta, use_ptype);
+
+            // Look up the destination ports of the whole burst within the port list.
+            if (flt->ports != NULL)
+            {
+                portmap_burst(flt->ports, &meta, port_hits);
+            }
+
+            // Drop anything but IPv4 (VLAN and QinQ tags were already skipped by the parser), TCP/UDP packets without ports along with listed destination ports and gather the keys of the rest.
+            fb.nb = 0;
 
-            // Loop through the amount of packets we have from the RX queue.
             for (j = 0; j < nb_rx; j++)
             {
-                // Assign the individual packet mbuf.
-                pckt = pckts_burst[j];
+                if (meta.l3[j] != PARSE_L3_IPV4)
+                {
+                    rte_pktmbuf_free(pckts_burst[j]);
 
-                // Prefetch the packet.
-                rte_prefetch0(rte_pktmbuf_mtod(pckt, void *));
+                    stats_drop(st, DROP_UNSUPPORTED);
 
-                // Lastly, inspect the packet.
-                inspect_pckt(pckt, port_id);
+                    continue;
+                }
+
+                // Non-first fragments (and truncated headers) have no ports to inspect. Their ports would be left at 0 and match rules they don't belong to, so fragmenting would get past any port rule.
+                if ((meta.proto[j] == PROTOCOL_TCP || meta.proto[j] == PROTOCOL_UDP) && !(meta.flags[j] & PARSE_F_L4))
+                {
+                    rte_pktmbuf_free(pckts_burst[j]);
+
+                    stats_drop(st, DROP_UNSUPPORTED);
+
+                    continue;
+                }
+
+                if (flt->ports != NULL && portmap_hit(port_hits, j))
+                {
+                    rte_pktmbuf_free(pckts_burst[j]);
+
+                    stats_drop(st, DROP_FILTER);
+
+                    continue;
+                }
+
+                filters_burst_add(&fb, pckts_burst[j], &meta, j);
+            }
+
+            // Classify all IPv4 packets of the burst against the rules (or run the eBPF program over them) at once.
+            filters_classify(flt, &fb);
+
+            // Inspect each packet with its action.
+            refl.nb = 0;
+
+            for (j = 0; j < fb.nb; j++)
+            {
+                unsigned idx = fb.idx[j];
+
+                if (inspect_pckt(pckts_burst[idx], &meta, idx, fb.results[j], st))
+                {
+                    reflect_list_add(&refl, pckts_burst[idx], &meta, idx);
+                }
             }
+
+            // Swap the MAC and IP addresses along with the UDP ports of the remaining packets (their checksums stay valid) and send them out our own TX queue.
+            reflect_burst(refl.eths, refl.iphs, refl.l4hs, refl.nb);
+
+            // Increment packets TX count before handing them over (packets the TX queue has no room for are moved to the drops).
+            stats_fwd_bulk(st, refl.nb);
+
+            queues_tx_burst(qconf, ports[port_id].tx_port, refl.pckts, refl.nb);
         }
+
+        // We no longer hold a reference to the rules.
+        rte_rcu_qsbr_quiescent(filters_rcu, lcore_id);
     }
+
+    // Make sure reloads don't wait on us after we exit.
+    rte_rcu_qsbr_thread_offline(filters_rcu, lcore_id);
+    rte_rcu_qsbr_thread_unregister(filters_rcu, lcore_id);
 }
 
 /**
@@ -312,38 +288,76 @@ static void sign_hdl(int tmp)
 }
 
 /**
- * The stats thread handler.
+ * The reload signal (SIGHUP) callback/handler.
  * 
  * @param tmp An unused variable.
  * 
  * @return Void
 **/
-void *hndl_stats(void *tmp)
+static void reload_hdl(int tmp)
 {
-    // Last updated variables.
-    __u64 last_fwd = 0;
-    __u64 last_drop = 0;
+    reload = 1;
+}
 
+/**
+ * The filters reload thread handler. Compiles the filters file (or loads the eBPF program) into new rules when a reload is requested, publishes them to the l-cores and frees the old rules after all l-cores went through a quiescent state.
+ * 
+ * @param tmp An unused variable.
+ * 
+ * @return Void
+**/
+void *hndl_reload(void *tmp)
+{
     // Run until program exits.
     while (!quit)
     {
-        // Retrieve current PPS.
-        __u64 fwd_pps = pckts_forwarded - last_fwd;
-        __u64 drop_pps = pckts_dropped - last_drop;
+        if (!reload)
+        {
+            usleep(RELOAD_CHECK_US);
+
+            continue;
+        }
+
+        reload = 0;
+
+        struct filters *old = cur_filters;
+
+        // Compile the new rules (or load and JIT compile the new program) off the datapath.
+        struct filters *flt = filters_create(cmd.filters, cmd.bpf, cmd.ports, old->generation + 1);
 
-        // Flush stdout and print stats.
-        fflush(stdout);
-        printf("\rForward => %llu. Drop => %llu.", fwd_pps, drop_pps);
+        if (flt == NULL)
+        {
+            printf("WARNING - Failed to create new filters, keeping the current rules.\n");
+
+            continue;
+        }
 
-        // Update last variables.
-        last_fwd = pckts_forwarded;
-        last_drop = pckts_dropped;
+        // Publish the new rules to the l-cores.
+        __atomic_store_n(&cur_filters, flt, __ATOMIC_RELEASE);
 
-        // Sleep for a second to avoid unnecessary CPU cycles.
-        sleep(1);
+        // Wait for every l-core to report a quiescent state so nothing references the old rules anymore and free them.
+        rte_rcu_qsbr_synchronize(filters_rcu, RTE_QSBR_THRID_INVALID);
+
+        filters_free(old);
     }
 }
 
+#if RTE_VERSION >= RTE_VERSION_NUM(23, 11, 0, 0)
+/**
+ * The filters reload thread's entry point for rte_thread_create_control(), which expects a function returning an exit code.
+ * 
+ * @param tmp An unused variable.
+ * 
+ * @return 0
+**/
+static uint32_t hndl_reload_ctrl(void *tmp)
+{
+    hndl_reload(tmp);
+
+    return 0;
+}
+#endif
+
 /**
  * The main function call.
  * 
@@ -373,9 +387,9 @@ int main(int argc, char **argv)
     quit = 0;
     signal(SIGINT, sign_hdl);
     signal(SIGTERM, sign_hdl);
+    signal(SIGHUP, reload_hdl);
 
     // Parse application-specific arguments.
-    struct cmdline cmd = {0};
     parsecmdline(&cmd, argc, argv);
 
     // Retrieve amount of l-cores.
@@ -404,26 +418,63 @@ int main(int argc, char **argv)
     // Populate our destination ports.
     dpdkc_populate_dst_ports();
 
-    // Initialize mbuf pool.
-    ret = dpdkc_create_mbuf();
+    // Create the RCU variable the l-cores report their quiescent states to.
+    size_t rcusz = rte_rcu_qsbr_get_memsize(RTE_MAX_LCORE);
 
-    dpdkc_check_ret(&ret);
+    filters_rcu = rte_zmalloc("filters_rcu", rcusz, RTE_CACHE_LINE_SIZE);
 
-    // Initialize each port.
-    ret = dpdkc_ports_queues_init(cmd.promisc, 1, 1);
+    if (filters_rcu == NULL || rte_rcu_qsbr_init(filters_rcu, RTE_MAX_LCORE) != 0)
+    {
+        rte_exit(EXIT_FAILURE, "Failed to create filters RCU variable.\n");
+    }
 
-    // Check for error and fail with it if there is.
-    dpdkc_check_ret(&ret);
+    // Compile the initial rules from the eBPF program or the filters file (or the built-in rules dropping UDP port 8080).
+    if (cmd.bpf != NULL && cmd.filters != NULL)
+    {
+        printf("WARNING - Both an eBPF program and a filters file were specified, the filters file is ignored.\n");
+    }
 
-    // Initialize the port and l-core mappings.
-    ret = dpdkc_ports_queues_mapping();
+    cur_filters = filters_create(cmd.filters, cmd.bpf, cmd.ports, 0);
 
-    dpdkc_check_ret(&ret);
+    if (cur_filters == NULL)
+    {
+        rte_exit(EXIT_FAILURE, "Failed to create filters.\n");
+    }
+
+    // Create a control thread that recompiles the rules when SIGHUP is received. Control threads run on the CPUs left over by the l-cores instead of the main l-core's, which polls queue 0.
+#if RTE_VERSION >= RTE_VERSION_NUM(23, 11, 0, 0)
+    rte_thread_t rpid;
+
+    if (rte_thread_create_control(&rpid, "filter-reload", hndl_reload_ctrl, NULL) != 0)
+#else
+    pthread_t rpid;
+
+    if (rte_ctrl_thread_create(&rpid, "filter-reload", NULL, hndl_reload, NULL) != 0)
+#endif
+    {
+        rte_exit(EXIT_FAILURE, "Failed to create the filters reload thread.\n");
+    }
+
+    // Select the widest header swap kernel the CPU supports.
+    printf("Reflecting packets with the %s kernel.\n", reflect_kernel_name(reflect_init()));
+
+    // Likewise for the port list lookup.
+    printf("Looking up port lists with the %s kernel.\n", portmap_kernel_name(portmap_init()));
+
+    // Initialize the mbuf pool and each port with the amount of RX/TX queues specified (RSS spreads flows across them).
+    int nb_ports = queues_ports_init(cmd.promisc, cmd.queues, cmd.hwmeta, 0);
 
     // Check for available ports.
-    ret = dpdkc_ports_available();
+    if (nb_ports <= 0)
+    {
+        rte_exit(EXIT_FAILURE, "Failed to initialize ports or all available ports are disabled (%d).\n", nb_ports);
+    }
 
-    dpdkc_check_ret(&ret);
+    // Map RX/TX queue N of each port to l-core N.
+    if (queues_lcores_init(cmd.queues) != 0)
+    {
+        rte_exit(EXIT_FAILURE, "Failed to map %u queues to l-cores (make sure there's at least one l-core per queue).\n", cmd.queues);
+    }
 
     // Check port link status for all ports.
     dpdkc_check_link_status();
@@ -433,7 +484,7 @@ int main(int argc, char **argv)
     {
         pthread_t pid;
 
-        pthread_create(&pid, NULL, hndl_stats, NULL);
+        pthread_create(&pid, NULL, stats_hndl, NULL);
     }
 
     // Launch the application on each l-core.
@@ -449,7 +500,7 @@ int main(int argc, char **argv)
 
     dpdkc_check_ret(&ret);
 
-    printf("Total Packets Forwarded => %llu.\nTotal Packets Dropped => %llu.\n\n", pckts_forwarded, pckts_dropped);
+    stats_print_totals();
 
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,631 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+
+#include <arpa/inet.h>
+
+#include <rte_common.h>
+#include <rte_errno.h>
+#include <rte_malloc.h>
+
+#include "filters.h"
+
+enum filters_field
+{
+    FILTERS_FIELD_PROTO = 0,
+    FILTERS_FIELD_SRC,
+    FILTERS_FIELD_DST,
+    FILTERS_FIELD_SPORT,
+    FILTERS_FIELD_DPORT
+};
+
+// The ACL reads its input as 4-byte words. The protocol must be the first field and be a single byte, the ports share a word.
+static const struct rte_acl_field_def filters_defs[FILTERS_NB_FIELDS] =
+{
+    {
+        .type = RTE_ACL_FIELD_TYPE_BITMASK,
+        .size = sizeof(__u8),
+        .field_index = FILTERS_FIELD_PROTO,
+        .input_index = 0,
+        .offset = offsetof(struct filters_key, proto)
+    },
+    {
+        .type = RTE_ACL_FIELD_TYPE_MASK,
+        .size = sizeof(__u32),
+        .field_index = FILTERS_FIELD_SRC,
+        .input_index = 1,
+        .offset = offsetof(struct filters_key, src_ip)
+    },
+    {
+        .type = RTE_ACL_FIELD_TYPE_MASK,
+        .size = sizeof(__u32),
+        .field_index = FILTERS_FIELD_DST,
+        .input_index = 2,
+        .offset = offsetof(struct filters_key, dst_ip)
+    },
+    {
+        .type = RTE_ACL_FIELD_TYPE_RANGE,
+        .size = sizeof(__u16),
+        .field_index = FILTERS_FIELD_SPORT,
+        .input_index = 3,
+        .offset = offsetof(struct filters_key, src_port)
+    },
+    {
+        .type = RTE_ACL_FIELD_TYPE_RANGE,
+        .size = sizeof(__u16),
+        .field_index = FILTERS_FIELD_DPORT,
+        .input_index = 3,
+        .offset = offsetof(struct filters_key, dst_port)
+    }
+};
+
+// The rules used without a filters file, which keep the application's original behavior (only UDP is reflected and UDP port 8080 is dropped).
+static const char *filters_builtin[] =
+{
+    "drop udp any any any 8080",
+    "allow udp any any any any",
+    "default drop"
+};
+
+/**
+ * Parses a rule action.
+ * 
+ * @param str The string to parse.
+ * @param action A pointer to store the action in.
+ * 
+ * @return 0 on success or -1 on error.
+**/
+static int filters_parse_action(const char *str, __u8 *action)
+{
+    if (strcmp(str, "drop") == 0)
+    {
+        *action = FILTERS_DROP;
+    }
+    else if (strcmp(str, "allow") == 0)
+    {
+        *action = FILTERS_ALLOW;
+    }
+    else
+    {
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Parses a protocol ("any", "tcp", "udp", "icmp" or a protocol number).
+ * 
+ * @param str The string to parse.
+ * @param field A pointer to the rule's protocol field.
+ * 
+ * @return 0 on success or -1 on error.
+**/
+static int filters_parse_proto(const char *str, struct rte_acl_field *field)
+{
+    unsigned long val;
+
+    if (strcmp(str, "any") == 0)
+    {
+        field->value.u8 = 0;
+        field->mask_range.u8 = 0;
+
+        return 0;
+    }
+
+    if (strcmp(str, "tcp") == 0)
+    {
+        val = IPPROTO_TCP;
+    }
+    else if (strcmp(str, "udp") == 0)
+    {
+        val = IPPROTO_UDP;
+    }
+    else if (strcmp(str, "icmp") == 0)
+    {
+        val = IPPROTO_ICMP;
+    }
+    else
+    {
+        char *end = NULL;
+
+        val = strtoul(str, &end, 10);
+
+        if (end == str || *end != '\0' || val > 0xFF)
+        {
+            return -1;
+        }
+    }
+
+    field->value.u8 = (__u8)val;
+    field->mask_range.u8 = 0xFF;
+
+    return 0;
+}
+
+/**
+ * Parses an IPv4 prefix ("any" or "<ip>[/<cidr>]").
+ * 
+ * @param str The string to parse (this is modified).
+ * @param field A pointer to the rule's address field.
+ * 
+ * @return 0 on success or -1 on error.
+**/
+static int filters_parse_prefix(char *str, struct rte_acl_field *field)
+{
+    unsigned long depth = 32;
+
+    if (strcmp(str, "any") == 0)
+    {
+        field->value.u32 = 0;
+        field->mask_range.u32 = 0;
+
+        return 0;
+    }
+
+    char *cidr = strchr(str, '/');
+
+    if (cidr != NULL)
+    {
+        *cidr = '\0';
+
+        char *end = NULL;
+
+        depth = strtoul(cidr + 1, &end, 10);
+
+        if (end == cidr + 1 || *end != '\0' || depth > 32)
+        {
+            return -1;
+        }
+    }
+
+    struct in_addr ipaddr;
+
+    if (inet_pton(AF_INET, str, &ipaddr) != 1)
+    {
+        return -1;
+    }
+
+    // Rules are in host byte order and the mask of a mask field is the prefix length.
+    field->value.u32 = ntohl(ipaddr.s_addr);
+    field->mask_range.u32 = (__u32)depth;
+
+    return 0;
+}
+
+/**
+ * Parses a port range ("any", "<port>" or "<low>-<high>").
+ * 
+ * @param str The string to parse.
+ * @param field A pointer to the rule's port field.
+ * 
+ * @return 0 on success or -1 on error.
+**/
+static int filters_parse_ports(const char *str, struct rte_acl_field *field)
+{
+    unsigned long lo;
+    unsigned long hi;
+    char *end = NULL;
+
+    if (strcmp(str, "any") == 0)
+    {
+        field->value.u16 = 0;
+        field->mask_range.u16 = 0xFFFF;
+
+        return 0;
+    }
+
+    lo = strtoul(str, &end, 10);
+
+    if (end == str || (*end != '\0' && *end != '-'))
+    {
+        return -1;
+    }
+
+    hi = lo;
+
+    if (*end == '-')
+    {
+        const char *start = end + 1;
+
+        hi = strtoul(start, &end, 10);
+
+        if (end == start || *end != '\0')
+        {
+            return -1;
+        }
+    }
+
+    if (lo > hi || hi > 0xFFFF)
+    {
+        return -1;
+    }
+
+    field->value.u16 = (__u16)lo;
+    field->mask_range.u16 = (__u16)hi;
+
+    return 0;
+}
+
+/**
+ * Parses a line in "<drop|allow> <protocol> <source prefix> <destination prefix> <source ports> <destination ports>" or "default <drop|allow>" format.
+ * 
+ * @param line The line to parse (this is modified).
+ * @param idx The line number (used for warnings).
+ * @param rule A pointer to the rule to fill.
+ * @param def_action A pointer to the rule set's default action (set by a "default" line).
+ * 
+ * @return 1 if a rule was parsed, 0 if the line is empty, a comment or sets the default action or -1 on error.
+**/
+static int filters_parse_line(char *line, int idx, struct filters_rule *rule, __u8 *def_action)
+{
+    char *tokens[FILTERS_NB_FIELDS + 1];
+    char *ptr = strtok(line, " \t\r\n");
+    int nb = 0;
+
+    // Skip empty lines and comments.
+    if (ptr == NULL || *ptr == '#')
+    {
+        return 0;
+    }
+
+    while (ptr != NULL)
+    {
+        if (nb >= FILTERS_NB_FIELDS + 1)
+        {
+            printf("WARNING - Filter #%d failed due to too many fields.\n", idx);
+
+            return -1;
+        }
+
+        tokens[nb++] = ptr;
+        ptr = strtok(NULL, " \t\r\n");
+    }
+
+    if (strcmp(tokens[0], "default") == 0)
+    {
+        if (nb != 2 || filters_parse_action(tokens[1], def_action) != 0)
+        {
+            printf("WARNING - Filter #%d failed due to invalid default action.\n", idx);
+
+            return -1;
+        }
+
+        return 0;
+    }
+
+    if (nb != FILTERS_NB_FIELDS + 1)
+    {
+        printf("WARNING - Filter #%d failed due to missing fields.\n", idx);
+
+        return -1;
+    }
+
+    __u8 action;
+
+    memset(rule, 0, sizeof(*rule));
+
+    if (filters_parse_action(tokens[0], &action) != 0)
+    {
+        printf("WARNING - Filter #%d failed due to invalid action (%s).\n", idx, tokens[0]);
+
+        return -1;
+    }
+
+    if (filters_parse_proto(tokens[1], &rule->field[FILTERS_FIELD_PROTO]) != 0)
+    {
+        printf("WARNING - Filter #%d failed due to invalid protocol (%s).\n", idx, tokens[1]);
+
+        return -1;
+    }
+
+    if (filters_parse_prefix(tokens[2], &rule->field[FILTERS_FIELD_SRC]) != 0 || filters_parse_prefix(tokens[3], &rule->field[FILTERS_FIELD_DST]) != 0)
+    {
+        printf("WARNING - Filter #%d failed due to invalid prefix.\n", idx);
+
+        return -1;
+    }
+
+    if (filters_parse_ports(tokens[4], &rule->field[FILTERS_FIELD_SPORT]) != 0 || filters_parse_ports(tokens[5], &rule->field[FILTERS_FIELD_DPORT]) != 0)
+    {
+        printf("WARNING - Filter #%d failed due to invalid port range.\n", idx);
+
+        return -1;
+    }
+
+    rule->data.userdata = action;
+    rule->data.category_mask = 1;
+
+    return 1;
+}
+
+/**
+ * Parses a line and appends the rule to the rules array, growing it if needed.
+ * 
+ * @param line The line to parse (this is modified).
+ * @param idx The line number.
+ * @param rules A pointer to the rules array.
+ * @param nb_rules A pointer to the amount of rules.
+ * @param max A pointer to the size of the rules array.
+ * @param def_action A pointer to the rule set's default action.
+ * 
+ * @return 0 on success (including lines that failed to parse, which are skipped) or -1 if the array couldn't be grown.
+**/
+static int filters_add_line(char *line, int idx, struct filters_rule **rules, unsigned *nb_rules, unsigned *max, __u8 *def_action)
+{
+    struct filters_rule rule;
+
+    if (filters_parse_line(line, idx, &rule, def_action) < 1)
+    {
+        return 0;
+    }
+
+    if (*nb_rules >= FILTERS_MAX_RULES)
+    {
+        printf("WARNING - Filter #%d failed due to the rule set being full (%d max).\n", idx, FILTERS_MAX_RULES);
+
+        return 0;
+    }
+
+    if (*nb_rules >= *max)
+    {
+        unsigned nmax = (*max == 0) ? 64 : *max * 2;
+        struct filters_rule *nrules = realloc(*rules, nmax * sizeof(struct filters_rule));
+
+        if (nrules == NULL)
+        {
+            return -1;
+        }
+
+        *rules = nrules;
+        *max = nmax;
+    }
+
+    // The first matching rule wins, so earlier rules get a higher priority.
+    rule.data.priority = RTE_ACL_MAX_PRIORITY - (int32_t)*nb_rules;
+
+    (*rules)[(*nb_rules)++] = rule;
+
+    return 0;
+}
+
+/**
+ * Compiles rules into an ACL context.
+ * 
+ * @param rules A pointer to the rules array.
+ * @param nb_rules The amount of rules.
+ * @param generation The rule set generation (used to give each ACL context a unique name).
+ * 
+ * @return A pointer to the ACL context or NULL on error.
+**/
+static struct rte_acl_ctx *filters_build(const struct filters_rule *rules, unsigned nb_rules, __u32 generation)
+{
+    char name[RTE_ACL_NAMESIZE];
+
+    // Contexts are looked up by name, so every rule set needs its own.
+    snprintf(name, sizeof(name), "filters_%u", generation);
+
+    struct rte_acl_param prm =
+    {
+        .name = name,
+        .socket_id = SOCKET_ID_ANY,
+        .rule_size = RTE_ACL_RULE_SZ(FILTERS_NB_FIELDS),
+        .max_rule_num = nb_rules
+    };
+
+    struct rte_acl_ctx *acx = rte_acl_create(&prm);
+
+    if (acx == NULL)
+    {
+        return NULL;
+    }
+
+    struct rte_acl_config cfg;
+
+    memset(&cfg, 0, sizeof(cfg));
+
+    cfg.num_categories = FILTERS_CATEGORIES;
+    cfg.num_fields = FILTERS_NB_FIELDS;
+
+    memcpy(cfg.defs, filters_defs, sizeof(filters_defs));
+
+    if (rte_acl_add_rules(acx, (const struct rte_acl_rule *)rules, nb_rules) != 0 || rte_acl_build(acx, &cfg) != 0)
+    {
+        rte_acl_free(acx);
+
+        return NULL;
+    }
+
+    return acx;
+}
+
+/**
+ * Loads an eBPF program from an ELF object file and JIT compiles it if possible.
+ * 
+ * @param f A pointer to the rule set to load the program into.
+ * @param file Path to the ELF object file.
+ * 
+ * @return 0 on success or -1 on error.
+**/
+static int filters_load_bpf(struct filters *f, const char *file)
+{
+    // The program is handed the packet's mbuf, so the verifier bounds its accesses to the mbuf and the packet data is read with bounds checked loads.
+    struct rte_bpf_prm prm =
+    {
+        .prog_arg =
+        {
+            .type = RTE_BPF_ARG_PTR_MBUF,
+            .size = sizeof(struct rte_mbuf),
+            .buf_size = RTE_MBUF_DEFAULT_BUF_SIZE
+        }
+    };
+
+    f->bpf = rte_bpf_elf_load(&prm, file, FILTERS_BPF_SECTION);
+
+    if (f->bpf == NULL)
+    {
+        printf("WARNING - Failed to load eBPF program from %s (section %s, error %d).\n", file, FILTERS_BPF_SECTION, rte_errno);
+
+        return -1;
+    }
+
+    // The interpreter is used on architectures without a JIT.
+    if (rte_bpf_get_jit(f->bpf, &f->jit) != 0)
+    {
+        f->jit.func = NULL;
+    }
+
+    printf("Loaded eBPF program %s (%s, generation %u)!\n", file, (f->jit.func != NULL) ? "JIT compiled" : "interpreted", f->generation);
+
+    return 0;
+}
+
+/**
+ * Creates a new rule set from a filters file (or an eBPF program) and compiles it. This is done off the datapath, so the l-cores keep classifying with the current rule set in the meantime.
+ * 
+ * @param file Path to the filters file (NULL uses the built-in rules, which drop UDP port 8080).
+ * @param bpf Path to an eBPF ELF object file to use instead of the rules (or NULL).
+ * @param ports Path to a port list file whose TCP and UDP destination ports are dropped before classifying (or NULL).
+ * @param generation The rule set generation.
+ * 
+ * @return A pointer to the new rule set or NULL on error.
+**/
+struct filters *filters_create(const char *file, const char *bpf, const char *ports, __u32 generation)
+{
+    struct filters_rule *rules = NULL;
+    unsigned nb_rules = 0;
+    unsigned max = 0;
+    int ret = 0;
+    int i = 0;
+
+    struct filters *f = rte_zmalloc("filters", sizeof(struct filters), RTE_CACHE_LINE_SIZE);
+
+    if (f == NULL)
+    {
+        return NULL;
+    }
+
+    f->generation = generation;
+    f->def_action = FILTERS_ALLOW;
+
+    if (ports != NULL)
+    {
+        f->ports = portmap_create(ports);
+
+        if (f->ports == NULL)
+        {
+            rte_free(f);
+
+            return NULL;
+        }
+    }
+
+    if (bpf != NULL)
+    {
+        if (filters_load_bpf(f, bpf) != 0)
+        {
+            filters_free(f);
+
+            return NULL;
+        }
+
+        return f;
+    }
+
+    if (file == NULL)
+    {
+        char line[128];
+
+        for (i = 0; i < (int)RTE_DIM(filters_builtin) && ret == 0; i++)
+        {
+            snprintf(line, sizeof(line), "%s", filters_builtin[i]);
+
+            ret = filters_add_line(line, i + 1, &rules, &nb_rules, &max, &f->def_action);
+        }
+    }
+    else
+    {
+        FILE *fp = fopen(file, "r");
+
+        if (!fp)
+        {
+            printf("WARNING - Failed to open filters file => %s.\n", file);
+
+            filters_free(f);
+
+            return NULL;
+        }
+
+        char *line = NULL;
+        size_t len = 0;
+
+        while (ret == 0 && getline(&line, &len, fp) != -1)
+        {
+            i++;
+
+            ret = filters_add_line(line, i, &rules, &nb_rules, &max, &f->def_action);
+        }
+
+        free(line);
+        fclose(fp);
+    }
+
+    if (ret != 0)
+    {
+        printf("WARNING - Failed to allocate filter rules.\n");
+
+        free(rules);
+        filters_free(f);
+
+        return NULL;
+    }
+
+    // Without rules, every packet gets the default action.
+    if (nb_rules > 0)
+    {
+        f->acx = filters_build(rules, nb_rules, generation);
+
+        if (f->acx == NULL)
+        {
+            printf("WARNING - Failed to build ACL context for %u filter rules.\n", nb_rules);
+
+            free(rules);
+            filters_free(f);
+
+            return NULL;
+        }
+    }
+
+    free(rules);
+
+    f->nb_rules = nb_rules;
+
+    printf("Loaded %u filter rules (default %s, generation %u)!\n", nb_rules, (f->def_action == FILTERS_DROP) ? "drop" : "allow", generation);
+
+    return f;
+}
+
+/**
+ * Frees a rule set along with its ACL context.
+ * 
+ * @param f A pointer to the rule set.
+ * 
+ * @return Void
+**/
+void filters_free(struct filters *f)
+{
+    if (f == NULL)
+    {
+        return;
+    }
+
+    if (f->bpf != NULL)
+    {
+        rte_bpf_destroy(f->bpf);
+    }
+
+    portmap_free(f->ports);
+    rte_acl_free(f->acx);
+    rte_free(f);
+}
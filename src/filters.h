@@ -0,0 +1,180 @@
+#ifndef FILTERS_HEADER
+#define FILTERS_HEADER
+
+#include <stdint.h>
+#include <linux/types.h>
+
+#include <rte_acl.h>
+#include <rte_bpf.h>
+#include <rte_mbuf.h>
+
+#include "parse.h"
+#include "portmap.h"
+
+// Protocol, source and destination address plus source and destination port.
+#define FILTERS_NB_FIELDS 5
+
+// The rules are compiled into a single category.
+#define FILTERS_CATEGORIES 1
+
+#define FILTERS_MAX_RULES 65536
+
+// The ELF section eBPF filter programs are loaded from (where clang puts functions without a section attribute).
+#define FILTERS_BPF_SECTION ".text"
+
+// The rule's action is stored as the ACL userdata, which is 0 for packets no rule matched.
+enum filters_action
+{
+    FILTERS_NO_MATCH = 0,
+    FILTERS_ALLOW,
+    FILTERS_DROP
+};
+
+// The classification key of a packet. Everything is in network byte order (as the ACL expects it) and the fields are laid out so each 4-byte input word holds a single field (or both ports).
+struct filters_key
+{
+    __u8 proto;
+    __u8 pad[3];
+    __u32 src_ip;
+    __u32 dst_ip;
+    __u16 src_port;
+    __u16 dst_port;
+};
+
+RTE_ACL_RULE_DEF(filters_rule, FILTERS_NB_FIELDS);
+
+// A compiled rule set (either ACL rules or an eBPF program). This is only ever replaced as a whole and the old rule set is freed once all l-cores went through a quiescent state.
+struct filters
+{
+    // NULL if the rule set has no rules.
+    struct rte_acl_ctx *acx;
+
+    // The eBPF program replacing the ACL rules (NULL if the rules are used) and its JIT compiled code (the func is NULL if the program is interpreted).
+    struct rte_bpf *bpf;
+    struct rte_bpf_jit jit;
+
+    // The destination ports to drop before classifying (NULL without a port list).
+    struct portmap *ports;
+
+    unsigned nb_rules;
+
+    // The action for packets no rule matched.
+    __u8 def_action;
+
+    __u32 generation;
+};
+
+// The IPv4 packets of an RX burst to classify along with their keys.
+struct filters_burst
+{
+    unsigned nb;
+
+    // The packet's index within the parsed burst.
+    __u16 idx[PARSE_MAX_BURST];
+
+    const __u8 *data[PARSE_MAX_BURST];
+    __u32 results[PARSE_MAX_BURST];
+    struct filters_key keys[PARSE_MAX_BURST];
+
+    // The packets themselves along with the return values of an eBPF program.
+    void *pckts[PARSE_MAX_BURST];
+    uint64_t rc[PARSE_MAX_BURST];
+};
+
+/**
+ * Adds an IPv4 packet of a parsed burst to the packets to classify. Only the parsed metadata is read.
+ * 
+ * @param fb A pointer to the filters burst.
+ * @param pckt A pointer to the rte_mbuf container the packet data.
+ * @param meta A pointer to the parsed metadata of the packet's burst.
+ * @param idx The packet's index within the burst.
+ * 
+ * @return Void
+**/
+static inline void filters_burst_add(struct filters_burst *fb, struct rte_mbuf *pckt, const struct parse_meta *meta, unsigned idx)
+{
+    struct filters_key *key = &fb->keys[fb->nb];
+
+    key->proto = meta->proto[idx];
+    key->src_ip = meta->src_ip[idx];
+    key->dst_ip = meta->dst_ip[idx];
+    key->src_port = meta->src_port[idx];
+    key->dst_port = meta->dst_port[idx];
+
+    fb->idx[fb->nb] = idx;
+    fb->pckts[fb->nb] = pckt;
+    fb->data[fb->nb] = (const __u8 *)key;
+    fb->nb++;
+}
+
+/**
+ * Runs the eBPF program over all packets of a filters burst. The program is handed each packet's mbuf and a return value of 0 drops the packet while anything else reflects it.
+ * 
+ * @param f A pointer to the rule set.
+ * @param fb A pointer to the filters burst.
+ * 
+ * @return Void
+**/
+static inline void filters_classify_bpf(const struct filters *f, struct filters_burst *fb)
+{
+    unsigned i;
+
+    if (f->jit.func != NULL)
+    {
+        for (i = 0; i < fb->nb; i++)
+        {
+            fb->rc[i] = f->jit.func(fb->pckts[i]);
+        }
+    }
+    else
+    {
+        rte_bpf_exec_burst(f->bpf, fb->pckts, fb->rc, fb->nb);
+    }
+
+    for (i = 0; i < fb->nb; i++)
+    {
+        fb->results[i] = (fb->rc[i] != 0) ? FILTERS_ALLOW : FILTERS_DROP;
+    }
+}
+
+/**
+ * Classifies all packets of a filters burst at once, storing each packet's action in the burst's results. The ACL walks a trie built from the rules, so the cost per packet doesn't depend on the amount of rules.
+ * 
+ * @param f A pointer to the rule set.
+ * @param fb A pointer to the filters burst.
+ * 
+ * @return Void
+**/
+static inline void filters_classify(const struct filters *f, struct filters_burst *fb)
+{
+    unsigned i;
+
+    if (f->bpf != NULL)
+    {
+        filters_classify_bpf(f, fb);
+
+        return;
+    }
+
+    if (fb->nb > 0 && f->acx != NULL && rte_acl_classify(f->acx, fb->data, fb->results, fb->nb, FILTERS_CATEGORIES) == 0)
+    {
+        for (i = 0; i < fb->nb; i++)
+        {
+            if (fb->results[i] == FILTERS_NO_MATCH)
+            {
+                fb->results[i] = f->def_action;
+            }
+        }
+
+        return;
+    }
+
+    for (i = 0; i < fb->nb; i++)
+    {
+        fb->results[i] = f->def_action;
+    }
+}
+
+struct filters *filters_create(const char *file, const char *bpf, const char *ports, __u32 generation);
+void filters_free(struct filters *f);
+#endif
@@ -0,0 +1,221 @@
+#include <string.h>
+
+#include <rte_byteorder.h>
+#include <rte_ether.h>
+#include <rte_ip.h>
+
+#include "parse.h"
+
+#define ETH_P_IP 0x0800
+#define ETH_P_IPV6 0x86DD
+#define ETH_P_8021Q 0x8100
+#define ETH_P_8021AD 0x88A8
+#define ETH_P_QINQ1 0x9100
+
+#define PROTOCOL_TCP 0x06
+#define PROTOCOL_UDP 0x11
+
+// How many packets ahead to prefetch.
+#define PARSE_PREFETCH 4
+
+/**
+ * Checks the packet type parsed by the NIC for packets that definitely aren't IPv4 or IPv6, so their headers don't need to be read at all.
+ * 
+ * @param pckt A pointer to the rte_mbuf container the packet data.
+ * 
+ * @return 1 if the NIC recognized the layer 3 header as something other than IPv4 or IPv6 or 0 if the packet needs to be parsed (including PMDs that don't parse packet types).
+**/
+static inline int parse_ptype_skip(const struct rte_mbuf *pckt)
+{
+    __u32 ptype = pckt->packet_type;
+
+    return (ptype & RTE_PTYPE_L3_MASK) != 0 && !RTE_ETH_IS_IPV4_HDR(ptype) && !RTE_ETH_IS_IPV6_HDR(ptype);
+}
+
+/**
+ * Clears a packet's burst metadata.
+ * 
+ * @param meta A pointer to the burst metadata.
+ * @param i The packet's index within the burst.
+ * 
+ * @return Void
+**/
+static inline void parse_clear(struct parse_meta *meta, unsigned i)
+{
+    meta->l3[i] = PARSE_L3_NONE;
+    meta->flags[i] = 0;
+    meta->proto[i] = 0;
+    meta->vlan[i] = 0;
+    meta->l3_off[i] = 0;
+    meta->l4_off[i] = 0;
+    meta->src_ip[i] = 0;
+    meta->dst_ip[i] = 0;
+    meta->src_port[i] = 0;
+    meta->dst_port[i] = 0;
+}
+
+/**
+ * Parses a single packet's headers into the burst metadata.
+ * 
+ * @param pckt A pointer to the rte_mbuf container the packet data.
+ * @param meta A pointer to the burst metadata.
+ * @param i The packet's index within the burst.
+ * 
+ * @return Void
+**/
+static inline void parse_pckt(struct rte_mbuf *pckt, struct parse_meta *meta, unsigned i)
+{
+    const __u8 *data = rte_pktmbuf_mtod(pckt, const __u8 *);
+    const unsigned len = rte_pktmbuf_data_len(pckt);
+
+    unsigned offset = sizeof(struct rte_ether_hdr);
+    unsigned j;
+
+    parse_clear(meta, i);
+
+    if (unlikely(len < offset))
+    {
+        return;
+    }
+
+    __u16 ether_type = rte_be_to_cpu_16(((const struct rte_ether_hdr *)data)->ether_type);
+
+    // Handle VLAN and QinQ tags, always continuing with the encapsulated type.
+    for (j = 0; j < PARSE_MAX_VLANS && (ether_type == ETH_P_8021Q || ether_type == ETH_P_8021AD || ether_type == ETH_P_QINQ1); j++)
+    {
+        if (unlikely(len < offset + sizeof(struct rte_vlan_hdr)))
+        {
+            return;
+        }
+
+        const struct rte_vlan_hdr *vlan = (const void *)(data + offset);
+
+        if (j == 0)
+        {
+            meta->vlan[i] = rte_be_to_cpu_16(vlan->vlan_tci) & 0x0FFF;
+        }
+
+        ether_type = rte_be_to_cpu_16(vlan->eth_proto);
+        offset += sizeof(struct rte_vlan_hdr);
+    }
+
+    meta->l3_off[i] = offset;
+
+    if (ether_type == ETH_P_IP)
+    {
+        const struct rte_ipv4_hdr *iph = (const void *)(data + offset);
+
+        if (unlikely(len < offset + sizeof(struct rte_ipv4_hdr)))
+        {
+            return;
+        }
+
+        // The header length includes options, make sure it's valid and within the packet.
+        unsigned ihl = (iph->version_ihl & RTE_IPV4_HDR_IHL_MASK) * RTE_IPV4_IHL_MULTIPLIER;
+
+        if (unlikely(ihl < sizeof(struct rte_ipv4_hdr) || len < offset + ihl))
+        {
+            return;
+        }
+
+        meta->l3[i] = PARSE_L3_IPV4;
+        meta->proto[i] = iph->next_proto_id;
+        meta->src_ip[i] = iph->src_addr;
+        meta->dst_ip[i] = iph->dst_addr;
+
+        offset += ihl;
+
+        if (iph->fragment_offset & rte_cpu_to_be_16(RTE_IPV4_HDR_MF_FLAG | RTE_IPV4_HDR_OFFSET_MASK))
+        {
+            meta->flags[i] |= PARSE_F_FRAG;
+
+            // Only the first fragment holds the layer 4 header.
+            if (iph->fragment_offset & rte_cpu_to_be_16(RTE_IPV4_HDR_OFFSET_MASK))
+            {
+                meta->l4_off[i] = offset;
+
+                return;
+            }
+        }
+    }
+    else if (ether_type == ETH_P_IPV6)
+    {
+        const struct rte_ipv6_hdr *ip6h = (const void *)(data + offset);
+
+        if (unlikely(len < offset + sizeof(struct rte_ipv6_hdr)))
+        {
+            return;
+        }
+
+        // Extension headers aren't walked, so the next header is the protocol.
+        meta->l3[i] = PARSE_L3_IPV6;
+        meta->proto[i] = ip6h->proto;
+
+        offset += sizeof(struct rte_ipv6_hdr);
+    }
+    else
+    {
+        return;
+    }
+
+    meta->l4_off[i] = offset;
+
+    // The source and destination ports are the first four bytes of both the TCP and UDP header.
+    if ((meta->proto[i] == PROTOCOL_TCP || meta->proto[i] == PROTOCOL_UDP) && len >= offset + 2 * sizeof(__u16))
+    {
+        memcpy(&meta->src_port[i], data + offset, sizeof(__u16));
+        memcpy(&meta->dst_port[i], data + offset + sizeof(__u16), sizeof(__u16));
+
+        meta->flags[i] |= PARSE_F_L4;
+    }
+}
+
+/**
+ * Parses the ethernet, VLAN/QinQ, IP and TCP/UDP headers of a whole RX burst into a structure of arrays.
+ * 
+ * @param pckts A pointer to the array of rte_mbuf containers from the RX burst.
+ * @param nb The amount of packets within the burst (at most PARSE_MAX_BURST).
+ * @param meta A pointer to the burst metadata to fill.
+ * @param use_ptype Whether to trust the packet types parsed by the NIC (hardware metadata mode). Packets the NIC recognized as neither IPv4 nor IPv6 are then skipped without reading their headers.
+ * 
+ * @return Void
+**/
+void parse_burst(struct rte_mbuf **pckts, unsigned nb, struct parse_meta *meta, unsigned use_ptype)
+{
+    unsigned i;
+
+    meta->nb = nb;
+
+    for (i = 0; i < PARSE_PREFETCH && i < nb; i++)
+    {
+        if (!use_ptype || !parse_ptype_skip(pckts[i]))
+        {
+            rte_prefetch0(rte_pktmbuf_mtod(pckts[i], void *));
+        }
+    }
+
+    for (i = 0; i < nb; i++)
+    {
+        // Prefetch a few packets ahead so their headers are in cache by the time we parse them (packets skipped by their packet type are never read).
+        if (i + PARSE_PREFETCH < nb && (!use_ptype || !parse_ptype_skip(pckts[i + PARSE_PREFETCH])))
+        {
+            rte_prefetch0(rte_pktmbuf_mtod(pckts[i + PARSE_PREFETCH], void *));
+        }
+
+        if (use_ptype && parse_ptype_skip(pckts[i]))
+        {
+            parse_clear(meta, i);
+        }
+        else
+        {
+            parse_pckt(pckts[i], meta, i);
+        }
+
+        // The RSS hash is in the mbuf's first cache line which the RX burst already touched.
+        if (pckts[i]->ol_flags & RTE_MBUF_F_RX_RSS_HASH)
+        {
+            meta->flags[i] |= PARSE_F_RSS;
+            meta->hash[i] = pckts[i]->hash.rss;
+        }
+    }
+}
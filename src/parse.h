@@ -0,0 +1,62 @@
+#ifndef PARSE_HEADER
+#define PARSE_HEADER
+
+#include <linux/types.h>
+
+#include <rte_mbuf.h>
+
+// The most packets parsed at once (RX bursts are capped to this).
+#define PARSE_MAX_BURST 256
+
+// Outer (S-VLAN) and inner (C-VLAN) tag.
+#define PARSE_MAX_VLANS 2
+
+enum parse_l3
+{
+    PARSE_L3_NONE = 0,
+    PARSE_L3_IPV4,
+    PARSE_L3_IPV6
+};
+
+// The packet is an IPv4 fragment.
+#define PARSE_F_FRAG 0x01
+
+// The packet has a TCP or UDP header (its ports are set).
+#define PARSE_F_L4 0x02
+
+// The NIC delivered the packet's RSS hash (hash is set).
+#define PARSE_F_RSS 0x04
+
+// Metadata of a whole RX burst laid out as a structure of arrays, so classifying a burst reads dense arrays instead of walking each packet's headers again. Index i describes the ith packet of the burst.
+struct parse_meta
+{
+    unsigned nb;
+
+    // The layer 3 type (PARSE_L3_NONE for anything else as well as truncated or malformed packets).
+    __u8 l3[PARSE_MAX_BURST];
+
+    // PARSE_F_* flags.
+    __u8 flags[PARSE_MAX_BURST];
+
+    // The IPv4 protocol or IPv6 next header.
+    __u8 proto[PARSE_MAX_BURST];
+
+    // The outermost VLAN ID (0 if the packet is untagged).
+    __u16 vlan[PARSE_MAX_BURST];
+
+    // Offsets from the start of the packet data. The layer 4 offset takes IPv4 options into account.
+    __u16 l3_off[PARSE_MAX_BURST];
+    __u16 l4_off[PARSE_MAX_BURST];
+
+    // IPv4 addresses and TCP/UDP ports in network byte order (zero if they don't apply).
+    __u32 src_ip[PARSE_MAX_BURST];
+    __u32 dst_ip[PARSE_MAX_BURST];
+    __u16 src_port[PARSE_MAX_BURST];
+    __u16 dst_port[PARSE_MAX_BURST];
+
+    // The RSS hash delivered by the NIC (only valid with PARSE_F_RSS).
+    __u32 hash[PARSE_MAX_BURST];
+};
+
+void parse_burst(struct rte_mbuf **pckts, unsigned nb, struct parse_meta *meta, unsigned use_ptype);
+#endif
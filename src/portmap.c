@@ -0,0 +1,340 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <rte_byteorder.h>
+#include <rte_cpuflags.h>
+#include <rte_malloc.h>
+#include <rte_vect.h>
+
+#include "portmap.h"
+
+#define PROTOCOL_TCP 0x06
+#define PROTOCOL_UDP 0x11
+
+/**
+ * Sets a port within a protocol's bitmap.
+ * 
+ * @param pm A pointer to the port bitmaps.
+ * @param tbl The protocol's bitmap (PORTMAP_TCP or PORTMAP_UDP).
+ * @param port The port in host byte order.
+ * 
+ * @return Void
+**/
+static void portmap_set(struct portmap *pm, unsigned tbl, __u16 port)
+{
+    __u16 nport = rte_cpu_to_be_16(port);
+
+    pm->bits[tbl][nport >> 5] |= 1U << (nport & 31);
+}
+
+/**
+ * Parses a line in "<tcp|udp|any> <port>[-<port>]" format and sets its ports.
+ * 
+ * @param pm A pointer to the port bitmaps.
+ * @param line The line to parse (this is modified).
+ * @param idx The line number (used for warnings).
+ * 
+ * @return The amount of ports set or -1 on error.
+**/
+static int portmap_parse_line(struct portmap *pm, char *line, int idx)
+{
+    char *proto = strtok(line, " \t\r\n");
+
+    // Skip empty lines and comments.
+    if (proto == NULL || *proto == '#')
+    {
+        return 0;
+    }
+
+    char *ports = strtok(NULL, " \t\r\n");
+
+    if (ports == NULL)
+    {
+        printf("WARNING - Port list entry #%d failed due to missing port.\n", idx);
+
+        return -1;
+    }
+
+    int tcp = (strcmp(proto, "tcp") == 0 || strcmp(proto, "any") == 0);
+    int udp = (strcmp(proto, "udp") == 0 || strcmp(proto, "any") == 0);
+
+    if (!tcp && !udp)
+    {
+        printf("WARNING - Port list entry #%d failed due to invalid protocol (%s).\n", idx, proto);
+
+        return -1;
+    }
+
+    char *end = NULL;
+    unsigned long lo = strtoul(ports, &end, 10);
+    unsigned long hi = lo;
+    int valid = (end != ports);
+
+    if (valid && *end == '-')
+    {
+        char *start = end + 1;
+
+        hi = strtoul(start, &end, 10);
+        valid = (end != start);
+    }
+
+    if (!valid || *end != '\0' || lo > hi || hi > 0xFFFF)
+    {
+        printf("WARNING - Port list entry #%d failed due to invalid port range (%s).\n", idx, ports);
+
+        return -1;
+    }
+
+    unsigned long port;
+
+    for (port = lo; port <= hi; port++)
+    {
+        if (tcp)
+        {
+            portmap_set(pm, PORTMAP_TCP, (__u16)port);
+        }
+
+        if (udp)
+        {
+            portmap_set(pm, PORTMAP_UDP, (__u16)port);
+        }
+    }
+
+    return (int)(hi - lo + 1);
+}
+
+/**
+ * Creates port bitmaps from a port list file.
+ * 
+ * @param file Path to the port list file.
+ * 
+ * @return A pointer to the port bitmaps or NULL on error.
+**/
+struct portmap *portmap_create(const char *file)
+{
+    FILE *fp = fopen(file, "r");
+
+    if (!fp)
+    {
+        printf("WARNING - Failed to open port list file => %s.\n", file);
+
+        return NULL;
+    }
+
+    struct portmap *pm = rte_zmalloc("portmap", sizeof(struct portmap), RTE_CACHE_LINE_SIZE);
+
+    if (pm == NULL)
+    {
+        fclose(fp);
+
+        return NULL;
+    }
+
+    char *line = NULL;
+    size_t len = 0;
+    int ports = 0;
+    int i = 0;
+
+    while (getline(&line, &len, fp) != -1)
+    {
+        int ret = portmap_parse_line(pm, line, ++i);
+
+        if (ret > 0)
+        {
+            ports += ret;
+        }
+    }
+
+    free(line);
+    fclose(fp);
+
+    printf("Loaded %d ports from port list %s!\n", ports, file);
+
+    return pm;
+}
+
+/**
+ * Frees port bitmaps.
+ * 
+ * @param pm A pointer to the port bitmaps.
+ * 
+ * @return Void
+**/
+void portmap_free(struct portmap *pm)
+{
+    rte_free(pm);
+}
+
+/**
+ * Looks up a single packet of a burst.
+ * 
+ * @param pm A pointer to the port bitmaps.
+ * @param meta A pointer to the parsed metadata of the burst.
+ * @param hits A pointer to the lookup results.
+ * @param i The packet's index within the burst.
+ * 
+ * @return Void
+**/
+static inline void portmap_lookup(const struct portmap *pm, const struct parse_meta *meta, __u64 *hits, unsigned i)
+{
+    // Only TCP and UDP packets have their ports set.
+    if (!(meta->flags[i] & PARSE_F_L4))
+    {
+        return;
+    }
+
+    unsigned tbl = (meta->proto[i] == PROTOCOL_UDP) ? PORTMAP_UDP : PORTMAP_TCP;
+
+    hits[i >> 6] |= (__u64)portmap_test(pm, tbl, meta->dst_port[i]) << (i & 63);
+}
+
+/**
+ * The scalar kernel, looking up one packet at a time.
+ * 
+ * @param pm A pointer to the port bitmaps.
+ * @param meta A pointer to the parsed metadata of the burst.
+ * @param hits A pointer to the lookup results.
+ * 
+ * @return Void
+**/
+static void portmap_burst_scalar(const struct portmap *pm, const struct parse_meta *meta, __u64 *hits)
+{
+    unsigned i;
+
+    memset(hits, 0, PORTMAP_HITS_WORDS * sizeof(__u64));
+
+    for (i = 0; i < meta->nb; i++)
+    {
+        portmap_lookup(pm, meta, hits, i);
+    }
+}
+
+#ifdef RTE_ARCH_X86
+/**
+ * The AVX2 kernel. Eight packets are looked up at once by gathering their bitmap words, with the lanes of packets that aren't TCP or UDP masked off so they're never read. The rest of the burst goes through the scalar lookup.
+ * 
+ * @param pm A pointer to the port bitmaps.
+ * @param meta A pointer to the parsed metadata of the burst.
+ * @param hits A pointer to the lookup results.
+ * 
+ * @return Void
+**/
+static __attribute__((target("avx2"))) void portmap_burst_avx2(const struct portmap *pm, const struct parse_meta *meta, __u64 *hits)
+{
+    const __m256i udp = _mm256_set1_epi32(PROTOCOL_UDP);
+    const __m256i l4 = _mm256_set1_epi32(PARSE_F_L4);
+    const __m256i udp_off = _mm256_set1_epi32(PORTMAP_WORDS);
+    const __m256i bit_mask = _mm256_set1_epi32(31);
+    const __m256i one = _mm256_set1_epi32(1);
+    unsigned i;
+
+    memset(hits, 0, PORTMAP_HITS_WORDS * sizeof(__u64));
+
+    for (i = 0; i + 8 <= meta->nb; i += 8)
+    {
+        __m256i proto = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)&meta->proto[i]));
+        __m256i flags = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)&meta->flags[i]));
+        __m256i port = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)&meta->dst_port[i]));
+
+        __m256i is_udp = _mm256_cmpeq_epi32(proto, udp);
+        __m256i valid = _mm256_cmpeq_epi32(_mm256_and_si256(flags, l4), l4);
+
+        // The UDP bitmap directly follows the TCP one.
+        __m256i idx = _mm256_add_epi32(_mm256_srli_epi32(port, 5), _mm256_and_si256(is_udp, udp_off));
+        __m256i words = _mm256_mask_i32gather_epi32(_mm256_setzero_si256(), (const int *)pm->bits, idx, valid, sizeof(__u32));
+        __m256i bits = _mm256_and_si256(_mm256_srlv_epi32(words, _mm256_and_si256(port, bit_mask)), one);
+
+        unsigned mask = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(bits, one)));
+
+        // Eight packets never straddle two words.
+        hits[i >> 6] |= (__u64)mask << (i & 63);
+    }
+
+    for (; i < meta->nb; i++)
+    {
+        portmap_lookup(pm, meta, hits, i);
+    }
+}
+#endif
+
+static const struct
+{
+    const char *name;
+    portmap_burst_t fn;
+} portmap_kernels[PORTMAP_MAX_KERNEL] =
+{
+    [PORTMAP_SCALAR] = {"scalar", portmap_burst_scalar},
+#ifdef RTE_ARCH_X86
+    [PORTMAP_AVX2] = {"avx2", portmap_burst_avx2},
+#else
+    [PORTMAP_AVX2] = {"avx2", NULL},
+#endif
+};
+
+portmap_burst_t portmap_burst_fn = portmap_burst_scalar;
+
+/**
+ * Retrieves the name of a kernel.
+ * 
+ * @param kernel The kernel.
+ * 
+ * @return The kernel's name.
+**/
+const char *portmap_kernel_name(enum portmap_kernel kernel)
+{
+    if (kernel >= PORTMAP_MAX_KERNEL)
+    {
+        return "unknown";
+    }
+
+    return portmap_kernels[kernel].name;
+}
+
+/**
+ * Selects the kernel portmap_burst() uses.
+ * 
+ * @param kernel The kernel.
+ * 
+ * @return 0 on success or -1 if the CPU doesn't support the kernel.
+**/
+int portmap_select(enum portmap_kernel kernel)
+{
+    if (kernel >= PORTMAP_MAX_KERNEL || portmap_kernels[kernel].fn == NULL)
+    {
+        return -1;
+    }
+
+#ifdef RTE_ARCH_X86
+    if (kernel == PORTMAP_AVX2 && rte_cpu_get_flag_enabled(RTE_CPUFLAG_AVX2) <= 0)
+    {
+        return -1;
+    }
+#endif
+
+    portmap_burst_fn = portmap_kernels[kernel].fn;
+
+    return 0;
+}
+
+/**
+ * Selects the widest kernel the CPU supports.
+ * 
+ * @return The kernel selected.
+**/
+enum portmap_kernel portmap_init(void)
+{
+    int kernel;
+
+    for (kernel = PORTMAP_MAX_KERNEL - 1; kernel > PORTMAP_SCALAR; kernel--)
+    {
+        if (portmap_select(kernel) == 0)
+        {
+            return kernel;
+        }
+    }
+
+    portmap_select(PORTMAP_SCALAR);
+
+    return PORTMAP_SCALAR;
+}
@@ -0,0 +1,85 @@
+#ifndef PORTMAP_HEADER
+#define PORTMAP_HEADER
+
+#include <linux/types.h>
+
+#include <rte_common.h>
+
+#include "parse.h"
+
+// One bit per port and protocol, 8 KB per protocol.
+#define PORTMAP_TCP 0
+#define PORTMAP_UDP 1
+#define PORTMAP_NB_PROTOS 2
+
+#define PORTMAP_WORDS (65536 / 32)
+
+// The lookup results of a burst are a bitmask with a bit per packet.
+#define PORTMAP_HITS_WORDS (PARSE_MAX_BURST / 64)
+
+// Destination port bitmaps of TCP and UDP. The bits are indexed by the port in network byte order, so the ports parsed from the packets are looked up as they are.
+struct portmap
+{
+    __u32 bits[PORTMAP_NB_PROTOS][PORTMAP_WORDS];
+} __rte_cache_aligned;
+
+/**
+ * Checks whether a port is set within a protocol's bitmap.
+ * 
+ * @param pm A pointer to the port bitmaps.
+ * @param tbl The protocol's bitmap (PORTMAP_TCP or PORTMAP_UDP).
+ * @param port The port in network byte order.
+ * 
+ * @return 1 if the port is set or 0 otherwise.
+**/
+static inline int portmap_test(const struct portmap *pm, unsigned tbl, __u16 port)
+{
+    return (pm->bits[tbl][port >> 5] >> (port & 31)) & 1;
+}
+
+/**
+ * Checks whether a packet's lookup within a burst hit.
+ * 
+ * @param hits A pointer to the burst's lookup results.
+ * @param idx The packet's index within the burst.
+ * 
+ * @return 1 if the packet's destination port is set or 0 otherwise.
+**/
+static inline int portmap_hit(const __u64 *hits, unsigned idx)
+{
+    return (hits[idx >> 6] >> (idx & 63)) & 1;
+}
+
+// The burst lookup kernels, selected at runtime by the CPU's flags.
+enum portmap_kernel
+{
+    PORTMAP_SCALAR = 0,
+    PORTMAP_AVX2,
+    PORTMAP_MAX_KERNEL
+};
+
+typedef void (*portmap_burst_t)(const struct portmap *pm, const struct parse_meta *meta, __u64 *hits);
+
+// The selected kernel (the scalar one until portmap_init() or portmap_select() is called).
+extern portmap_burst_t portmap_burst_fn;
+
+/**
+ * Looks up the destination port of every TCP and UDP packet within a parsed burst with the selected kernel.
+ * 
+ * @param pm A pointer to the port bitmaps.
+ * @param meta A pointer to the parsed metadata of the burst.
+ * @param hits A pointer to the PORTMAP_HITS_WORDS words to store the results in (a set bit means the packet's destination port is set).
+ * 
+ * @return Void
+**/
+static inline void portmap_burst(const struct portmap *pm, const struct parse_meta *meta, __u64 *hits)
+{
+    portmap_burst_fn(pm, meta, hits);
+}
+
+struct portmap *portmap_create(const char *file);
+void portmap_free(struct portmap *pm);
+const char *portmap_kernel_name(enum portmap_kernel kernel);
+int portmap_select(enum portmap_kernel kernel);
+enum portmap_kernel portmap_init(void);
+#endif
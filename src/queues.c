@@ -0,0 +1,451 @@
+#include <stdio.h>
+#include <errno.h>
+#include <inttypes.h>
+
+#include <dpdk_common.h>
+#include <rte_malloc.h>
+#include <rte_flow.h>
+
+#include "queues.h"
+#include "stats.h"
+
+#define RX_DESC_DEFAULT 1024
+#define TX_DESC_DEFAULT 1024
+
+#define MBUF_CACHE_SIZE 256
+#define MIN_NB_MBUFS 8192
+
+#define MAX_PTYPES 64
+
+struct lcore_queue_conf lcore_queue_conf[RTE_MAX_LCORE];
+
+// The commonly used default Toeplitz key. Programming it explicitly (instead of leaving the PMD's own) lets software reproduce the NIC's hash for packets without one.
+const __u8 queues_rss_key[QUEUES_RSS_KEY_LEN] =
+{
+    0x6d, 0x5a, 0x56, 0xda, 0x25, 0x5b, 0x0e, 0xc2,
+    0x41, 0x67, 0x25, 0x3d, 0x43, 0xa3, 0x8f, 0xb0,
+    0xd0, 0xca, 0x2b, 0xcb, 0xae, 0x7b, 0x30, 0xb4,
+    0x77, 0xcb, 0x2d, 0xa3, 0x80, 0x30, 0xf2, 0x0c,
+    0x6a, 0x42, 0xb7, 0x3b, 0xbe, 0xac, 0x01, 0xfa
+};
+
+__u8 queues_hw_meta[RTE_MAX_ETHPORTS];
+
+/**
+ * Checks whether a port's NIC parses IPv4 packet types.
+ * 
+ * @param port_id The port ID.
+ * 
+ * @return 1 if the NIC reports IPv4 packet types or 0 otherwise.
+**/
+static int queues_port_has_ptype(__u16 port_id)
+{
+    __u32 ptypes[MAX_PTYPES];
+    int nb;
+    int i;
+
+    nb = rte_eth_dev_get_supported_ptypes(port_id, RTE_PTYPE_L3_MASK, ptypes, MAX_PTYPES);
+
+    for (i = 0; i < nb && i < MAX_PTYPES; i++)
+    {
+        if (RTE_ETH_IS_IPV4_HDR(ptypes[i]))
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Steers a port's IPv4 packets across its RX queues with an RSS flow rule. The port's RSS configuration only applies its fields to the packet types they name, so PMDs such as i40e and ice leave TCP and UDP packets unhashed (and on queue 0) with RTE_ETH_RSS_IPV4 alone. A flow rule matching every IPv4 packet hashes all of them, whatever their L4 protocol, on the same fields.
+ * 
+ * @param port_id The port ID.
+ * @param nb_queues The amount of RX queues to spread packets across.
+ * @param rss_hf The RSS fields to hash on.
+ * @param key_len The port's RSS key length (queues_rss_key is only used if it fits).
+ * 
+ * @return 0 on success or -ENOTSUP if the port doesn't support the rule.
+**/
+static int queues_port_rss_flow(__u16 port_id, __u16 nb_queues, __u64 rss_hf, __u8 key_len)
+{
+    __u16 queues[RTE_MAX_QUEUES_PER_PORT];
+    struct rte_flow_error err = {0};
+    __u16 q;
+
+    for (q = 0; q < nb_queues; q++)
+    {
+        queues[q] = q;
+    }
+
+    struct rte_flow_attr attr =
+    {
+        .ingress = 1
+    };
+
+    struct rte_flow_item pattern[] =
+    {
+        { .type = RTE_FLOW_ITEM_TYPE_ETH },
+        { .type = RTE_FLOW_ITEM_TYPE_IPV4 },
+        { .type = RTE_FLOW_ITEM_TYPE_END }
+    };
+
+    struct rte_flow_action_rss rss =
+    {
+        .func = RTE_ETH_HASH_FUNCTION_TOEPLITZ,
+        .level = 0,
+        .types = rss_hf,
+        .key_len = (key_len == QUEUES_RSS_KEY_LEN) ? QUEUES_RSS_KEY_LEN : 0,
+        .queue_num = nb_queues,
+        .key = (key_len == QUEUES_RSS_KEY_LEN) ? queues_rss_key : NULL,
+        .queue = queues
+    };
+
+    struct rte_flow_action actions[] =
+    {
+        { .type = RTE_FLOW_ACTION_TYPE_RSS, .conf = &rss },
+        { .type = RTE_FLOW_ACTION_TYPE_END }
+    };
+
+    if (rte_flow_validate(port_id, &attr, pattern, actions, &err) != 0 || rte_flow_create(port_id, &attr, pattern, actions, &err) == NULL)
+    {
+        RTE_LOG(ERR, USER1, "Port %u doesn't support an RSS flow rule on the required fields, so it can't use more than one queue (%s).\n", port_id, err.message ? err.message : "unknown error");
+
+        return -ENOTSUP;
+    }
+
+    return 0;
+}
+
+/**
+ * Sets up a single port with the amount of RX and TX queues specified. RSS is enabled when more than one queue is used so the NIC spreads flows across the queues. In hardware metadata mode, RSS is always enabled with queues_rss_key so every packet carries its hash and the NIC's packet type parsing is kept on, otherwise packet type parsing is turned off to save the PMD the work.
+ * 
+ * @param port_id The port ID to setup.
+ * @param nb_queues The amount of RX and TX queues.
+ * @param promisc Whether to enable promiscuous mode.
+ * @param hwmeta Whether to enable hardware metadata mode.
+ * @param rss_hf The RSS fields to hash on (0 for QUEUES_RSS_DEFAULT). Specific fields are required with more than one queue, since the caller relies on them to steer packets, and IPv4 packets are then steered by an RSS flow rule (see queues_port_rss_flow()).
+ * @param pool The mbuf pool to use for the RX queues.
+ * 
+ * @return 0 on success or negative error code.
+**/
+static int queues_port_init(__u16 port_id, __u16 nb_queues, unsigned promisc, unsigned hwmeta, __u64 rss_hf, struct rte_mempool *pool)
+{
+    struct rte_eth_dev_info dev_info;
+    struct rte_eth_conf port_conf = {0};
+    __u16 nb_rxd = RX_DESC_DEFAULT;
+    __u16 nb_txd = TX_DESC_DEFAULT;
+    __u16 q;
+    int ret;
+
+    ret = rte_eth_dev_info_get(port_id, &dev_info);
+
+    if (ret != 0)
+    {
+        return ret;
+    }
+
+    // Make sure the port supports the amount of queues requested.
+    if (nb_queues > dev_info.max_rx_queues || nb_queues > dev_info.max_tx_queues)
+    {
+        return -EINVAL;
+    }
+
+    port_conf.txmode.mq_mode = RTE_ETH_MQ_TX_NONE;
+
+    // Spreading packets by fewer fields than requested would hand packets the caller expects on one queue to several l-cores.
+    if (rss_hf != 0 && nb_queues > 1 && (rss_hf & dev_info.flow_type_rss_offloads) != rss_hf)
+    {
+        RTE_LOG(ERR, USER1, "Port %u can't hash on the RSS fields required to use more than one queue (0x%" PRIx64 " of 0x%" PRIx64 " supported).\n", port_id, rss_hf & dev_info.flow_type_rss_offloads, rss_hf);
+
+        return -ENOTSUP;
+    }
+
+    // Specific fields are steered with a flow rule once the port is started.
+    unsigned rss_flow = (rss_hf != 0 && nb_queues > 1);
+
+    if (rss_hf == 0)
+    {
+        rss_hf = QUEUES_RSS_DEFAULT;
+    }
+
+    queues_hw_meta[port_id] = 0;
+
+    // Spread flows across the RX queues using the NIC's RSS hash on the IP and L4 headers.
+    if (nb_queues > 1 || hwmeta)
+    {
+        port_conf.rxmode.mq_mode = RTE_ETH_MQ_RX_RSS;
+        port_conf.rx_adv_conf.rss_conf.rss_key = NULL;
+        port_conf.rx_adv_conf.rss_conf.rss_hf = rss_hf & dev_info.flow_type_rss_offloads;
+    }
+
+    if (hwmeta)
+    {
+        // Software can only reproduce the hash if the NIC takes our key and hashes exactly the fields requested.
+        if (dev_info.hash_key_size == QUEUES_RSS_KEY_LEN && (rss_hf & dev_info.flow_type_rss_offloads) == rss_hf)
+        {
+            port_conf.rx_adv_conf.rss_conf.rss_key = (__u8 *)queues_rss_key;
+            port_conf.rx_adv_conf.rss_conf.rss_key_len = QUEUES_RSS_KEY_LEN;
+
+            queues_hw_meta[port_id] |= QUEUES_HW_RSS;
+        }
+
+        if (dev_info.rx_offload_capa & RTE_ETH_RX_OFFLOAD_RSS_HASH)
+        {
+            port_conf.rxmode.offloads |= RTE_ETH_RX_OFFLOAD_RSS_HASH;
+        }
+    }
+
+    ret = rte_eth_dev_configure(port_id, nb_queues, nb_queues, &port_conf);
+
+    if (ret != 0)
+    {
+        return ret;
+    }
+
+    if (hwmeta)
+    {
+        if (queues_port_has_ptype(port_id))
+        {
+            queues_hw_meta[port_id] |= QUEUES_HW_PTYPE;
+        }
+
+        RTE_LOG(INFO, USER1, "Port %u hardware metadata: packet type %s, RSS hash %s.\n", port_id, (queues_hw_meta[port_id] & QUEUES_HW_PTYPE) ? "yes" : "no (software parsing)", (queues_hw_meta[port_id] & QUEUES_HW_RSS) ? "yes" : "no (software hash)");
+    }
+    else
+    {
+        // Nothing looks at the packet type, so don't have the PMD fill it in (not every PMD supports this, which is fine).
+        rte_eth_dev_set_ptypes(port_id, RTE_PTYPE_UNKNOWN, NULL, 0);
+    }
+
+    ret = rte_eth_dev_adjust_nb_rx_tx_desc(port_id, &nb_rxd, &nb_txd);
+
+    if (ret != 0)
+    {
+        return ret;
+    }
+
+    // Retrieve the port's MAC address.
+    ret = rte_eth_macaddr_get(port_id, &ports[port_id].mac);
+
+    if (ret != 0)
+    {
+        return ret;
+    }
+
+    // Setup each RX and TX queue.
+    for (q = 0; q < nb_queues; q++)
+    {
+        ret = rte_eth_rx_queue_setup(port_id, q, nb_rxd, rte_eth_dev_socket_id(port_id), NULL, pool);
+
+        if (ret < 0)
+        {
+            return ret;
+        }
+
+        ret = rte_eth_tx_queue_setup(port_id, q, nb_txd, rte_eth_dev_socket_id(port_id), NULL);
+
+        if (ret < 0)
+        {
+            return ret;
+        }
+    }
+
+    ret = rte_eth_dev_start(port_id);
+
+    if (ret < 0)
+    {
+        return ret;
+    }
+
+    if (promisc)
+    {
+        ret = rte_eth_promiscuous_enable(port_id);
+
+        if (ret != 0)
+        {
+            return ret;
+        }
+    }
+
+    if (rss_flow)
+    {
+        return queues_port_rss_flow(port_id, nb_queues, rss_hf, dev_info.hash_key_size);
+    }
+
+    return 0;
+}
+
+/**
+ * Creates the mbuf pool and sets up every enabled port with the amount of RX and TX queues specified.
+ * 
+ * @param promisc Whether to enable promiscuous mode on all enabled ports.
+ * @param nb_queues The amount of RX and TX queues per port (0 is treated as 1).
+ * @param hwmeta Whether to have the NICs deliver packet types and RSS hashes.
+ * @param rss_hf The RSS fields to hash on (0 for QUEUES_RSS_DEFAULT). With more than one queue, ports that can't hash every IPv4 packet on exactly these fields fail to setup.
+ * 
+ * @return The amount of ports setup or negative error code.
+**/
+int queues_ports_init(unsigned promisc, __u16 nb_queues, unsigned hwmeta, __u64 rss_hf)
+{
+    __u16 port_id;
+    unsigned nb_ports = 0;
+    int ret;
+
+    if (nb_queues < 1)
+    {
+        nb_queues = 1;
+    }
+
+    // Count the enabled ports so we can size the mbuf pool.
+    RTE_ETH_FOREACH_DEV(port_id)
+    {
+        if ((enabled_port_mask & (1 << port_id)) != 0)
+        {
+            nb_ports++;
+        }
+    }
+
+    // Every queue needs enough mbufs for its descriptors along with a burst and each l-core's cache.
+    unsigned nb_mbufs = RTE_MAX(nb_ports * nb_queues * (RX_DESC_DEFAULT + TX_DESC_DEFAULT + packet_burst_size) + rte_lcore_count() * MBUF_CACHE_SIZE, MIN_NB_MBUFS);
+
+    struct rte_mempool *pool = rte_pktmbuf_pool_create("queues_mbuf_pool", nb_mbufs, MBUF_CACHE_SIZE, 0, RTE_MBUF_DEFAULT_BUF_SIZE, rte_socket_id());
+
+    if (pool == NULL)
+    {
+        return -rte_errno;
+    }
+
+    nb_ports = 0;
+
+    RTE_ETH_FOREACH_DEV(port_id)
+    {
+        if ((enabled_port_mask & (1 << port_id)) == 0)
+        {
+            continue;
+        }
+
+        ret = queues_port_init(port_id, nb_queues, promisc, hwmeta, rss_hf, pool);
+
+        if (ret != 0)
+        {
+            fprintf(stderr, "Failed to setup port %u with %u queues (%d).\n", port_id, nb_queues, ret);
+
+            return ret;
+        }
+
+        nb_ports++;
+    }
+
+    return nb_ports;
+}
+
+/**
+ * The TX buffer error callback. Frees the packets the TX queue had no room for and moves them from the l-core's forwarded counter (they're counted when they're handed to the TX buffer) to its drops.
+ * 
+ * @param pckts A pointer to the unsent packets.
+ * @param unsent The amount of unsent packets.
+ * @param userdata A pointer to the l-core's stats block.
+ * 
+ * @return Void
+**/
+static void queues_tx_drop_callback(struct rte_mbuf **pckts, uint16_t unsent, void *userdata)
+{
+    struct lcore_stats *st = userdata;
+    uint16_t i;
+
+    for (i = 0; i < unsent; i++)
+    {
+        rte_pktmbuf_free(pckts[i]);
+    }
+
+    st->forwarded -= unsent;
+    st->dropped[DROP_TX_FULL] += unsent;
+}
+
+/**
+ * Maps RX/TX queue N of every enabled port to the Nth l-core and gives each l-core its own TX buffer for every enabled port.
+ * 
+ * @param nb_queues The amount of RX and TX queues per port (0 is treated as 1).
+ * 
+ * @return 0 on success or negative error code.
+**/
+int queues_lcores_init(__u16 nb_queues)
+{
+    unsigned lcore_id;
+    __u16 port_id;
+    __u16 idx = 0;
+
+    if (nb_queues < 1)
+    {
+        nb_queues = 1;
+    }
+
+    RTE_LCORE_FOREACH(lcore_id)
+    {
+        struct lcore_queue_conf *qconf = &lcore_queue_conf[lcore_id];
+
+        // L-cores past the amount of queues have nothing to do.
+        if (idx >= nb_queues)
+        {
+            break;
+        }
+
+        qconf->tx_queue_id = idx;
+
+        RTE_ETH_FOREACH_DEV(port_id)
+        {
+            if ((enabled_port_mask & (1 << port_id)) == 0)
+            {
+                continue;
+            }
+
+            if (qconf->num_rx_queues >= MAX_RX_QUEUES_PER_LCORE)
+            {
+                return -E2BIG;
+            }
+
+            // Poll queue N of this port.
+            qconf->rx_queues[qconf->num_rx_queues].port_id = port_id;
+            qconf->rx_queues[qconf->num_rx_queues].queue_id = idx;
+            qconf->num_rx_queues++;
+        }
+
+        // Create a TX buffer for every enabled port, packets may be routed out of any of them.
+        RTE_ETH_FOREACH_DEV(port_id)
+        {
+            if ((enabled_port_mask & (1 << port_id)) == 0)
+            {
+                continue;
+            }
+
+            __u16 dst_port = port_id;
+
+            qconf->tx_buffers[dst_port] = rte_zmalloc_socket("tx_buffer", RTE_ETH_TX_BUFFER_SIZE(packet_burst_size), RTE_CACHE_LINE_SIZE, rte_eth_dev_socket_id(dst_port));
+
+            if (qconf->tx_buffers[dst_port] == NULL)
+            {
+                return -ENOMEM;
+            }
+
+            rte_eth_tx_buffer_init(qconf->tx_buffers[dst_port], packet_burst_size);
+
+            // Count packets the TX queue had no room for as drops of this l-core.
+            rte_eth_tx_buffer_set_err_callback(qconf->tx_buffers[dst_port], queues_tx_drop_callback, &lcore_stats[lcore_id]);
+
+            qconf->tx_port_list[qconf->num_tx_ports++] = dst_port;
+        }
+
+        RTE_LOG(INFO, USER1, "lcore %u owns RX/TX queue %u on %u ports.\n", lcore_id, idx, qconf->num_rx_queues);
+
+        idx++;
+    }
+
+    // Every queue needs an l-core polling it, otherwise its packets would never be processed.
+    if (idx < nb_queues)
+    {
+        return -EINVAL;
+    }
+
+    return 0;
+}
@@ -0,0 +1,88 @@
+#ifndef QUEUES_HEADER
+#define QUEUES_HEADER
+
+#include <linux/types.h>
+
+#include <rte_ethdev.h>
+
+#define MAX_RX_QUEUES_PER_LCORE 16
+
+// The default fields the NIC's RSS hash covers.
+#define QUEUES_RSS_DEFAULT (RTE_ETH_RSS_IP | RTE_ETH_RSS_TCP | RTE_ETH_RSS_UDP)
+
+// The length of the Toeplitz RSS key programmed in hardware metadata mode.
+#define QUEUES_RSS_KEY_LEN 40
+
+// The port delivers the packet type parsed by the NIC (mbuf->packet_type).
+#define QUEUES_HW_PTYPE 0x01
+
+// The port delivers the RSS hash (mbuf->hash.rss) computed with queues_rss_key and supports every field requested. rte_softrss() reproduces the hash if the PMD hashes exactly those fields, which some don't (e.g. L4 ports along with L3_SRC_ONLY), so users of the hash have to check it.
+#define QUEUES_HW_RSS 0x02
+
+struct lcore_rx_queue
+{
+    __u16 port_id;
+    __u16 queue_id;
+};
+
+struct lcore_queue_conf
+{
+    // The RX queues (one per enabled port) this l-core polls.
+    unsigned num_rx_queues;
+    struct lcore_rx_queue rx_queues[MAX_RX_QUEUES_PER_LCORE];
+
+    // The TX queue this l-core owns on every port (same index as its RX queues).
+    __u16 tx_queue_id;
+
+    // The ports this l-core transmits on (every enabled port) and its own TX buffer for each port.
+    unsigned num_tx_ports;
+    __u16 tx_port_list[RTE_MAX_ETHPORTS];
+    struct rte_eth_dev_tx_buffer *tx_buffers[RTE_MAX_ETHPORTS];
+} __rte_cache_aligned;
+
+extern struct lcore_queue_conf lcore_queue_conf[RTE_MAX_LCORE];
+
+extern const __u8 queues_rss_key[QUEUES_RSS_KEY_LEN];
+
+// The QUEUES_HW_* flags of every port (only set in hardware metadata mode).
+extern __u8 queues_hw_meta[RTE_MAX_ETHPORTS];
+
+/**
+ * Transmits a group of packets going out the same port on the l-core's own TX queue. Groups that would fill the port's TX buffer anyways are sent with a single TX burst right away (after flushing what's buffered so the order is kept), smaller groups are buffered to be batched with later bursts.
+ * 
+ * @param qconf A pointer to the l-core's queue config.
+ * @param port_id The egress port.
+ * @param pckts A pointer to the array of packets.
+ * @param nb The amount of packets.
+ * 
+ * @return Void
+**/
+static inline void queues_tx_burst(struct lcore_queue_conf *qconf, __u16 port_id, struct rte_mbuf **pckts, __u16 nb)
+{
+    struct rte_eth_dev_tx_buffer *buffer = qconf->tx_buffers[port_id];
+    __u16 i;
+
+    if (nb < buffer->size - buffer->length)
+    {
+        for (i = 0; i < nb; i++)
+        {
+            rte_eth_tx_buffer(port_id, qconf->tx_queue_id, buffer, pckts[i]);
+        }
+
+        return;
+    }
+
+    rte_eth_tx_buffer_flush(port_id, qconf->tx_queue_id, buffer);
+
+    __u16 sent = rte_eth_tx_burst(port_id, qconf->tx_queue_id, pckts, nb);
+
+    // Packets the TX queue had no room for are handled like the TX buffer would (freed and counted as drops).
+    if (unlikely(sent < nb))
+    {
+        buffer->error_callback(&pckts[sent], nb - sent, buffer->error_userdata);
+    }
+}
+
+int queues_ports_init(unsigned promisc, __u16 nb_queues, unsigned hwmeta, __u64 rss_hf);
+int queues_lcores_init(__u16 nb_queues);
+#endif
@@ -18,191 +18,585 @@
 #include <rte_ip.h>
 #include <rte_tcp.h>
 #include <rte_udp.h>
+#include <rte_thash.h>
+#include <rte_meter.h>
 
 #include "cmdline.h"
+#include "queues.h"
+#include "stats.h"
+#include "parse.h"
+#include "reflect.h"
+#include "cksum.h"
 
 /* Helpful defines */
 #ifndef htons
 #define htons(o) cpu_to_be16(o)
 #endif
 
-#define ETH_P_IP 0x0800
-#define ETH_P_8021Q	0x8100
-#define PROTOCOL_UDP 0x11
-#define PROTOCOL_TCP 0x06
-
 #define MAX_TABLE_SIZE 100000
 
+// The NIC hashes (and spreads packets across queues) by the source address only, which is the rate limit key. No L4 types are requested, since some PMDs still hash the ports of those along with L3_SRC_ONLY. With more than one queue, the port's RSS would leave TCP and UDP packets unhashed on PMDs such as i40e and ice, so queues_ports_init() steers every IPv4 packet with an RSS flow rule on these fields instead.
+#define RL_RSS_HF (RTE_ETH_RSS_IPV4 | RTE_ETH_RSS_L3_SRC_ONLY)
+
+// A port's RSS hashes are only trusted as table signatures while they match the software hash, which every this many'th hash is checked against (a power of two).
+#define RL_RSS_CHECK_INTERVAL 64
+
+// Token bucket costs are TSC ticks with this many fractional bits, so the cost of a packet or byte keeps a fractional part even at high rates. The times themselves are plain TSC ticks, which take over a century to wrap even at 5 GHz.
+#define RL_COST_SHIFT 8
+
+// The subnet tiers every source address also counts against (its /24 and its /16).
+#define RL_NB_TIERS 2
+
+// Each tier's table is a set associative cache of prefixes (the amount of sets must be a power of two). Tables don't grow with the amount of sources, so spoofed addresses can't exhaust them. The hosts of a subnet are spread across all queues, so the tables are shared by every l-core.
+#define RL_TIER_WAYS 4
+#define RL_TIER24_SETS 16384
+#define RL_TIER16_SETS 4096
+
+// Each source either has a packet and a byte token bucket or (in metering mode) an RFC 2697/2698 meter. The meter's profile is shared, so only its running state is kept per source.
 struct rate_limit
 {
-    __u64 pps;
-    __u64 bps;
+    union
+    {
+        // The token buckets refill continuously at the limit's rate. A bucket is tracked as the TSC time it'll be full again, which is never behind now. Taking tokens moves that time ahead by their cost and the bucket runs dry once it's further ahead than the burst size allows.
+        struct
+        {
+            __u64 pps_full;
+            __u64 bps_full;
+        };
+
+        struct rte_meter_srtcm srtcm;
+        struct rte_meter_trtcm trtcm;
+    };
 
     __u64 lastupdate;
 };
 
-//#define DEBUG
+// An l-core's view of which ports deliver RSS hashes it can use as table signatures.
+struct rl_rss
+{
+    __u8 trusted[RTE_MAX_ETHPORTS];
+    __u32 checks;
+};
+
+// A token bucket's parameters. These are computed once, so enforcing the limits only takes additions and compares.
+struct rl_bucket
+{
+    // The TSC ticks a packet or byte costs with RL_COST_SHIFT fractional bits (0 if there's no limit).
+    __u64 cost;
+
+    // How far ahead of now (in TSC ticks) the bucket's full time may get, which is the cost of the burst size.
+    __u64 tolerance;
+};
+
+struct rl_limits
+{
+    struct rl_bucket pps;
+    struct rl_bucket bps;
 
-__u64 pckts_forwarded = 0;
-__u64 pckts_dropped = 0;
+    // CMDLINE_METER_NONE uses the token buckets, otherwise the meter profile.
+    unsigned meter;
+    struct rte_meter_srtcm_profile srtcm;
+    struct rte_meter_trtcm_profile trtcm;
+
+    // The DSCP yellow packets are remarked with.
+    __u8 yellow_dscp;
+};
+
+// A subnet's token buckets within a tier's table (see struct rate_limit). Every l-core updates them with atomics.
+struct rl_prefix
+{
+    __u64 pps_full;
+    __u64 bps_full;
+
+    // The prefix in host byte order.
+    __u32 prefix;
+};
+
+// A subnet tier with its own packet and byte budget per prefix.
+struct rl_tier
+{
+    // The prefix length and its mask in host byte order.
+    unsigned plen;
+    __u32 mask;
+
+    struct rl_bucket pps;
+    struct rl_bucket bps;
+
+    // How far a prefix's hash is shifted to get its set and the sets themselves (RL_TIER_WAYS entries each).
+    unsigned set_shift;
+    struct rl_prefix *entries;
+};
+
+//#define DEBUG
 
 struct cmdline cmd = {0};
 
+// The subnet tiers shared by all l-cores.
+static struct rl_tier rl_tiers[RL_NB_TIERS];
+
+// Bucket times are TSC ticks relative to when the application started, so zeroed entries are full buckets. The TSC is synchronized across cores, so every l-core shares this time base.
+static __u64 rl_starttsc;
+
 /**
- * Swaps the source and destination ethernet MAC addresses.
+ * Hashes a rate limit key (the source IPv4 address in network byte order) exactly like the NIC's RSS does with RL_RSS_HF and queues_rss_key. This is the rate limit tables' hash function in hardware metadata mode, so keys hashed by the NIC and by software always land in the same bucket.
  * 
- * @param eth A pointer to the ethernet header (struct rte_ether_hdr).
+ * @param key A pointer to the key.
+ * @param key_len The key's length (unused, always four bytes).
+ * @param init_val The initial value (unused).
  * 
- * @return Void
+ * @return The 32-bit hash.
 **/
-static void swap_eth(struct rte_ether_hdr *eth)
+static __u32 rl_rss_hash(const void *key, __rte_unused __u32 key_len, __rte_unused __u32 init_val)
 {
-    struct rte_ether_addr tmp;
-    rte_ether_addr_copy(&eth->src_addr, &tmp);
+    __u32 tuple = rte_be_to_cpu_32(*(const __u32 *)key);
 
-    rte_ether_addr_copy(&eth->dst_addr, &eth->src_addr);
-    rte_ether_addr_copy(&tmp, &eth->dst_addr);
+    return rte_softrss(&tuple, 1, queues_rss_key);
 }
 
 /**
- * Swaps the source and destination IP addresses.
+ * Retrieves the rate limit table signature of a packet's source address. The NIC's RSS hash of the source address is used when the port delivers one we can reproduce (hardware metadata mode), otherwise the key is hashed in software. Since a PMD may hash more fields than requested, every RL_RSS_CHECK_INTERVAL'th hash is checked against the software hash and a mismatch has the l-core hash the port's packets in software from then on (so a source never ends up in the table under different signatures for long).
  * 
- * @param iph A pointer to the IPv4 header (struct rte_ipv4_hdr).
+ * @param rl_tbl A pointer to the rate limit hash table.
+ * @param meta A pointer to the parsed metadata of the packet's burst.
+ * @param idx The packet's index within the burst.
+ * @param port_id The port ID the packet came from.
+ * @param rss A pointer to the l-core's RSS state.
  * 
- * @return Void
+ * @return The signature.
 **/
-static void swap_iph(struct rte_ipv4_hdr *iph)
+static inline hash_sig_t rl_sig(void *rl_tbl, const struct parse_meta *meta, unsigned idx, unsigned port_id, struct rl_rss *rss)
 {
-    rte_be32_t tmp;
-    memcpy(&tmp, &iph->src_addr, sizeof(tmp));
+    if (!(meta->flags[idx] & PARSE_F_RSS) || !rss->trusted[port_id])
+    {
+        return rte_hash_hash(rl_tbl, &meta->src_ip[idx]);
+    }
+
+    if ((rss->checks++ & (RL_RSS_CHECK_INTERVAL - 1)) != 0)
+    {
+        return meta->hash[idx];
+    }
+
+    hash_sig_t sig = rte_hash_hash(rl_tbl, &meta->src_ip[idx]);
+
+    if (unlikely(sig != meta->hash[idx]))
+    {
+        rss->trusted[port_id] = 0;
+
+        RTE_LOG(WARNING, USER1, "Port %u's RSS hash doesn't match the source address hash on l-core %u, hashing its packets in software (the NIC may spread a source's packets across queues).\n", port_id, rte_lcore_id());
+    }
 
-    memcpy(&iph->src_addr, &iph->dst_addr, sizeof(iph->src_addr));
-    memcpy(&iph->dst_addr, &tmp, sizeof(iph->dst_addr));
+    return sig;
 }
 
 /**
- * Swaps the source and destination TCP ports.
+ * Sets up a token bucket.
  * 
- * @param tcph A pointer to the TCP header (struct rte_tcp_hdr).
+ * @param b A pointer to the token bucket.
+ * @param rate The rate per second (0 for no limit).
+ * @param burst The burst size (0 for one second's worth).
  * 
  * @return Void
 **/
-static void swap_tcph(struct rte_tcp_hdr *tcph)
+static void rl_bucket_init(struct rl_bucket *b, __u64 rate, __u64 burst)
 {
-    rte_be16_t tmp;
-    memcpy(&tmp, &tcph->src_port, sizeof(tmp));
+    b->cost = 0;
+    b->tolerance = 0;
 
-    memcpy(&tcph->src_port, &tcph->dst_port, sizeof(tcph->src_port));
-    memcpy(&tcph->dst_port, &tmp, sizeof(tcph->dst_port));
+    if (rate == 0)
+    {
+        return;
+    }
+
+    if (burst == 0)
+    {
+        burst = rate;
+    }
+
+    b->cost = RTE_MAX((rte_get_tsc_hz() << RL_COST_SHIFT) / rate, (__u64)1);
+    b->tolerance = (burst > UINT64_MAX / 2 / b->cost) ? UINT64_MAX / 2 : (burst * b->cost) >> RL_COST_SHIFT;
 }
 
 /**
- * Swaps the source and destination UDP ports.
+ * Takes tokens out of a token bucket.
  * 
- * @param udph A pointer to the UDP header (struct rte_udp_hdr).
+ * @param b A pointer to the token bucket's parameters.
+ * @param full A pointer to the time the bucket is full again.
+ * @param now The current TSC time.
+ * @param n The amount of tokens to take.
  * 
- * @return Void
+ * @return 0 if the tokens were taken or -1 if the bucket doesn't hold enough tokens (in which case it's left as is).
 **/
-static void swap_udph(struct rte_udp_hdr *udph)
+static inline int rl_bucket_take(const struct rl_bucket *b, __u64 *full, __u64 now, __u64 n)
 {
-    rte_be16_t tmp;
-    memcpy(&tmp, &udph->src_port, sizeof(tmp));
+    // A bucket that went idle long enough is simply full. The fractional part of the cost is dropped per take (at most one tick), but not per token.
+    __u64 nfull = RTE_MAX(*full, now) + ((n * b->cost) >> RL_COST_SHIFT);
+
+    if (nfull - now > b->tolerance)
+    {
+        return -1;
+    }
+
+    *full = nfull;
 
-    memcpy(&udph->src_port, &udph->dst_port, sizeof(udph->src_port));
-    memcpy(&udph->dst_port, &tmp, sizeof(udph->dst_port));
+    return 0;
 }
 
 /**
- * Inspects a packet and checks against UDP destination port 8080.
+ * Takes tokens out of a token bucket shared by l-cores. This is rl_bucket_take() as a compare and swap loop, so concurrent takes never lose each other's tokens.
  * 
- * @param pckt A pointer to the rte_mbuf container the packet data.
- * @param portid The port ID we're inspecting from.
- * @param rl_tbl A pointer to the rate limit hash table.
- * @param pps Packets per second limit (from command line).
- * @param bps Bytes per second limit (from command line).
+ * @param b A pointer to the token bucket's parameters.
+ * @param full A pointer to the time the bucket is full again.
+ * @param now The current TSC time.
+ * @param n The amount of tokens to take.
+ * 
+ * @return 0 if the tokens were taken or -1 if the bucket doesn't hold enough tokens (in which case it's left as is).
+**/
+static inline int rl_bucket_take_shared(const struct rl_bucket *b, __u64 *full, __u64 now, __u64 n)
+{
+    __u64 cost = (n * b->cost) >> RL_COST_SHIFT;
+    __u64 cur = __atomic_load_n(full, __ATOMIC_RELAXED);
+    __u64 nfull;
+
+    do
+    {
+        nfull = RTE_MAX(cur, now) + cost;
+
+        if (nfull - now > b->tolerance)
+        {
+            return -1;
+        }
+    } while (!__atomic_compare_exchange_n(full, &cur, nfull, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+    return 0;
+}
+
+/**
+ * Puts tokens taken with rl_bucket_take_shared() back into the bucket.
+ * 
+ * @param b A pointer to the token bucket's parameters.
+ * @param full A pointer to the time the bucket is full again.
+ * @param n The amount of tokens to put back.
  * 
  * @return Void
 **/
-static void inspect_pckt(struct rte_mbuf *pckt, unsigned port_id, void *rl_tbl, __u64 pps, __u64 bps)
+static inline void rl_bucket_refund(const struct rl_bucket *b, __u64 *full, __u64 n)
 {
-    // Data points to the start of packet data within the mbuf.
-    void *data = pckt->buf_addr + pckt->data_off;
+    // The full time was moved ahead by at least this much when the tokens were taken, so it can't go below zero.
+    __atomic_fetch_sub(full, (n * b->cost) >> RL_COST_SHIFT, __ATOMIC_RELAXED);
+}
 
-    // The offset.
-    unsigned int offset = 0;
+/**
+ * Sets up a subnet tier and allocates its table. This is done once before the l-cores are launched since they all share the table.
+ * 
+ * @param tier A pointer to the tier.
+ * @param plen The prefix length.
+ * @param sets The amount of sets within the tier's table (a power of two).
+ * @param pps The packets per second each prefix is limited to (0 for no limit).
+ * @param bps The bytes per second each prefix is limited to (0 for no limit).
+ * 
+ * @return 0 on success or -1 if the table couldn't be allocated.
+**/
+static int rl_tier_init(struct rl_tier *tier, unsigned plen, __u32 sets, __u64 pps, __u64 bps)
+{
+    tier->plen = plen;
+    tier->mask = ~0U << (32 - plen);
+    tier->set_shift = 32 - rte_log2_u32(sets);
+    tier->entries = NULL;
 
-    // Initialize ethernet header.
-    struct rte_ether_hdr *eth = data;
+    rl_bucket_init(&tier->pps, pps, 0);
+    rl_bucket_init(&tier->bps, bps, 0);
 
-    offset += sizeof(struct rte_ether_hdr);
+    // Tiers without limits don't need a table.
+    if (tier->pps.cost == 0 && tier->bps.cost == 0)
+    {
+        return 0;
+    }
+
+    // Zeroed entries are full buckets (the time they're full again is never ahead of now), so every way starts out free.
+    tier->entries = rte_zmalloc("rate_limit_prefixes", (size_t)sets * RL_TIER_WAYS * sizeof(struct rl_prefix), RTE_CACHE_LINE_SIZE);
+
+    return (tier->entries != NULL) ? 0 : -1;
+}
+
+/**
+ * Finds a source's prefix within a tier's table, claiming a way of its set if the prefix isn't in the table. Ways whose buckets are full again are free to claim since a full bucket is all a new prefix would start out with. If every way of the set is busy, the prefix is charged against the way that'll be full again first, so colliding subnets share a budget instead of one of them going unlimited. Should another l-core claim the same way at once, whichever claim loses simply shares the winner's budget.
+ * 
+ * @param tier A pointer to the tier.
+ * @param src The source address in host byte order.
+ * @param now The current TSC time.
+ * 
+ * @return A pointer to the prefix's entry.
+**/
+static inline struct rl_prefix *rl_tier_lookup(struct rl_tier *tier, __u32 src, __u64 now)
+{
+    __u32 prefix = src & tier->mask;
 
-    // Make sure we're dealing with IPv4 or a VLAN.
-    if (eth->ether_type != htons(ETH_P_IP) && eth->ether_type != htons(ETH_P_8021Q))
+    // Spread the prefixes across the sets (Fibonacci hashing of the prefix's significant bits).
+    __u32 set = ((prefix >> (32 - tier->plen)) * 2654435761U) >> tier->set_shift;
+
+    struct rl_prefix *ways = &tier->entries[set * RL_TIER_WAYS];
+    struct rl_prefix *best = &ways[0];
+    __u64 best_full = UINT64_MAX;
+    unsigned i;
+
+    for (i = 0; i < RL_TIER_WAYS; i++)
     {
-        rte_pktmbuf_free(pckt);
+        __u64 full = RTE_MAX(__atomic_load_n(&ways[i].pps_full, __ATOMIC_RELAXED), __atomic_load_n(&ways[i].bps_full, __ATOMIC_RELAXED));
 
-        return;
+        if (__atomic_load_n(&ways[i].prefix, __ATOMIC_RELAXED) == prefix)
+        {
+            return &ways[i];
+        }
+
+        if (full < best_full)
+        {
+            best = &ways[i];
+            best_full = full;
+        }
     }
 
-    // Handle VLAN.
-    if (eth->ether_type == htons(ETH_P_8021Q))
+    if (best_full <= now)
     {
-        // VLAN header length is four bytes, so increase offset by that amount.
-        offset += 4;
+        __atomic_store_n(&best->prefix, prefix, __ATOMIC_RELAXED);
     }
 
-    // Initialize IPv4 header.
-    struct rte_ipv4_hdr *iph = data + offset;
+    return best;
+}
 
-    // Increase offset.
-    offset += (iph->ihl * 4);
+/**
+ * Charges a packet against its prefix's packet and byte budgets within a tier.
+ * 
+ * @param tier A pointer to the tier.
+ * @param p A pointer to the prefix's entry.
+ * @param now The current TSC time.
+ * @param len The packet's length.
+ * 
+ * @return 0 if the packet was charged or -1 if it's over either budget (in which case neither is charged).
+**/
+static inline int rl_tier_take(struct rl_tier *tier, struct rl_prefix *p, __u64 now, __u64 len)
+{
+    if (rl_bucket_take_shared(&tier->pps, &p->pps_full, now, 1) != 0)
+    {
+        return -1;
+    }
 
-    // Retrieve timestamp.
-    __u64 ts = (rte_rdtsc() / rte_get_tsc_hz());
+    if (rl_bucket_take_shared(&tier->bps, &p->bps_full, now, len) != 0)
+    {
+        rl_bucket_refund(&tier->pps, &p->pps_full, 1);
 
-    // First, we'll want to look up the source IP on the rate limit map.
-    struct rate_limit *rl;
+        return -1;
+    }
 
-    int ret = rte_hash_lookup_data(rl_tbl, &iph->src_addr, (void **)&rl);
+    return 0;
+}
 
-    // Check the result.
-    if (ret >= 0)
+/**
+ * Puts a packet charged with rl_tier_take() back into its prefix's budgets.
+ * 
+ * @param tier A pointer to the tier.
+ * @param p A pointer to the prefix's entry.
+ * @param len The packet's length.
+ * 
+ * @return Void
+**/
+static inline void rl_tier_refund(struct rl_tier *tier, struct rl_prefix *p, __u64 len)
+{
+    rl_bucket_refund(&tier->pps, &p->pps_full, 1);
+    rl_bucket_refund(&tier->bps, &p->bps_full, len);
+}
+
+/**
+ * Configures the meter profiles from the command line. Unset burst sizes default to one second's worth of their rate.
+ * 
+ * @param srtcm A pointer to the single rate three color marker profile.
+ * @param trtcm A pointer to the two rate three color marker profile.
+ * 
+ * @return 0 on success or -1 if the parameters of the selected meter are invalid.
+**/
+static int rl_meter_profiles(struct rte_meter_srtcm_profile *srtcm, struct rte_meter_trtcm_profile *trtcm)
+{
+    switch (cmd.meter)
     {
-        // Check if we've exceeded within one second.
-        if ((ts - rl->lastupdate) > 1)
+        case CMDLINE_METER_SRTCM:
         {
-            // Set PPS and BPS counters to 0.
-            rl->pps = 0;
-            rl->bps = 0;
+            struct rte_meter_srtcm_params params =
+            {
+                .cir = cmd.cir,
+                .cbs = cmd.cbs ? cmd.cbs : cmd.cir,
+                .ebs = cmd.ebs ? cmd.ebs : cmd.cir
+            };
 
-            // Reset time stamp.
-            rl->lastupdate = ts;
+            return (rte_meter_srtcm_profile_config(srtcm, &params) == 0) ? 0 : -1;
         }
-        else
-        {
-            // Increment PPS and BPS.
-            rl->pps++;
-            rl->bps += pckt->pkt_len;
 
-            // Now check if we exceed packets per second or bytes per second. If so, drop the packet.
-            if ((pps > 0 && rl->pps >= pps) || (bps > 0 && rl->bps >= bps))
+        case CMDLINE_METER_TRTCM:
+        {
+            struct rte_meter_trtcm_params params =
             {
-                // Free packet's mbuf back to memory pool.
-                rte_pktmbuf_free(pckt);
+                .cir = cmd.cir,
+                .pir = cmd.pir,
+                .cbs = cmd.cbs ? cmd.cbs : cmd.cir,
+                .pbs = cmd.pbs ? cmd.pbs : cmd.pir
+            };
+
+            return (rte_meter_trtcm_profile_config(trtcm, &params) == 0) ? 0 : -1;
+        }
+    }
 
-                // Increment drop counter.
-                pckts_dropped++;
+    return 0;
+}
 
-#ifdef DEBUG
-                printf("Dropping packet due to rate limit! (%llu >= %llu || %llu >= %llu).\n", rl->pps, pps, rl->bps, bps);
-#endif
+/**
+ * Sets up the rate limit state of a new source.
+ * 
+ * @param rl A pointer to the source's rate limit entry.
+ * @param lim A pointer to the rate limit parameters.
+ * @param now The current TSC time.
+ * 
+ * @return Void
+**/
+static inline void rl_init(struct rate_limit *rl, struct rl_limits *lim, __u64 now)
+{
+    rl->lastupdate = now;
+
+    switch (lim->meter)
+    {
+        case CMDLINE_METER_SRTCM:
+            rte_meter_srtcm_config(&rl->srtcm, &lim->srtcm);
+
+            break;
+
+        case CMDLINE_METER_TRTCM:
+            rte_meter_trtcm_config(&rl->trtcm, &lim->trtcm);
+
+            break;
+
+        default:
+            // New sources start with full buckets.
+            rl->pps_full = now;
+            rl->bps_full = now;
+    }
+}
+
+/**
+ * Polices a packet of a source, coloring it by the source's meter (metering mode) or its token buckets (which only color packets green or red).
+ * 
+ * @param rl A pointer to the source's rate limit entry.
+ * @param lim A pointer to the rate limit parameters.
+ * @param now The current TSC time.
+ * @param tsc The current TSC (the meters take raw TSC cycles).
+ * @param len The packet's length in bytes.
+ * 
+ * @return The packet's color.
+**/
+static inline enum rte_color rl_police(struct rate_limit *rl, struct rl_limits *lim, __u64 now, __u64 tsc, __u32 len)
+{
+    rl->lastupdate = now;
 
-                return;
+    switch (lim->meter)
+    {
+        case CMDLINE_METER_SRTCM:
+            return rte_meter_srtcm_color_blind_check(&rl->srtcm, &lim->srtcm, tsc, len);
+
+        case CMDLINE_METER_TRTCM:
+            return rte_meter_trtcm_color_blind_check(&rl->trtcm, &lim->trtcm, tsc, len);
+    }
+
+    __u64 pps_full = rl->pps_full;
+    __u64 bps_full = rl->bps_full;
+
+    // Take a packet and the packet's length in bytes out of the buckets. If either runs dry, the packet is red (and nothing is taken).
+    if (rl_bucket_take(&lim->pps, &pps_full, now, 1) != 0 || rl_bucket_take(&lim->bps, &bps_full, now, len) != 0)
+    {
+        return RTE_COLOR_RED;
+    }
+
+    rl->pps_full = pps_full;
+    rl->bps_full = bps_full;
+
+    return RTE_COLOR_GREEN;
+}
+
+/**
+ * Inspects a packet and checks its source IP against the rate limits. The subnet tiers are charged first and a packet dropped by a later limit is refunded to them, so a dropped packet never counts against any budget. Green packets are reflected as they are, yellow ones are remarked with a lower DSCP first and red ones are dropped.
+ * 
+ * @param pckt A pointer to the rte_mbuf container the packet data.
+ * @param meta A pointer to the parsed metadata of the packet's burst.
+ * @param idx The packet's index within the burst.
+ * @param port_id The port ID we're inspecting from.
+ * @param rss A pointer to the l-core's RSS state.
+ * @param st A pointer to the l-core's stats block.
+ * @param rl_tbl A pointer to the rate limit hash table.
+ * @param rl_entries A pointer to the rate limit entries (indexed by the key's position within the table).
+ * @param lim A pointer to the rate limit parameters.
+ * @param tiers A pointer to the subnet tiers shared by all l-cores (RL_NB_TIERS of them).
+ * @param now The current TSC time, taken once per burst.
+ * @param tsc The TSC the current time was taken from.
+ * 
+ * @return 1 if the packet should be reflected or 0 if it was dropped (and freed).
+**/
+static int inspect_pckt(struct rte_mbuf *pckt, const struct parse_meta *meta, unsigned idx, unsigned port_id, struct rl_rss *rss, struct lcore_stats *st, void *rl_tbl, struct rate_limit *rl_entries, struct rl_limits *lim, struct rl_tier *tiers, __u64 now, __u64 tsc)
+{
+    // Make sure we're dealing with IPv4 (VLAN and QinQ tags were already skipped by the parser).
+    if (meta->l3[idx] != PARSE_L3_IPV4)
+    {
+        rte_pktmbuf_free(pckt);
+
+        stats_drop(st, DROP_UNSUPPORTED);
+
+        return 0;
+    }
+
+    // Charge the source's subnets against their tiers' budgets. Other l-cores charge the same subnets, so the charge has to be taken right away rather than kept aside until the packet passes all limits.
+    __u32 src = rte_be_to_cpu_32(meta->src_ip[idx]);
+
+    struct rl_prefix *prefixes[RL_NB_TIERS];
+    unsigned t;
+
+    for (t = 0; t < RL_NB_TIERS; t++)
+    {
+        struct rl_tier *tier = &tiers[t];
+
+        prefixes[t] = NULL;
+
+        if (tier->entries == NULL)
+        {
+            continue;
+        }
+
+        prefixes[t] = rl_tier_lookup(tier, src, now);
+
+        if (rl_tier_take(tier, prefixes[t], now, pckt->pkt_len) != 0)
+        {
+            // Refund the subnets already charged.
+            while (t-- > 0)
+            {
+                if (prefixes[t] != NULL)
+                {
+                    rl_tier_refund(&tiers[t], prefixes[t], pckt->pkt_len);
+                }
             }
+
+            rte_pktmbuf_free(pckt);
+
+            stats_drop(st, DROP_PREFIX_LIMIT);
+
+            return 0;
         }
     }
-    else
+
+    hash_sig_t sig = rl_sig(rl_tbl, meta, idx, port_id, rss);
+
+    // First, we'll want to look up the source IP on the rate limit map.
+    struct rate_limit *rl = NULL;
+
+    int ret = rte_hash_lookup_with_hash_data(rl_tbl, &meta->src_ip[idx], sig, (void **)&rl);
+
+    // Check the result.
+    if (ret < 0)
     {
+        rl = NULL;
+
         // Check LRU table.
         if (check_and_del_lru_from_hash_table(rl_tbl, MAX_TABLE_SIZE) == 0)
         {
@@ -210,15 +604,22 @@ static void inspect_pckt(struct rte_mbuf *pckt, unsigned port_id, void *rl_tbl,
             printf("Adding new IP to table (LRU check valid).\n");
 #endif
 
-            // We'll want to insert a new entry into the table.
-            struct rate_limit newrl = 
+            // The key's position is unique while it's within the table, so its entry lives at that index of the entries array (the table only holds a pointer to it).
+            int pos = rte_hash_add_key_with_hash(rl_tbl, &meta->src_ip[idx], sig);
+
+            if (pos >= 0 && pos < MAX_TABLE_SIZE)
             {
-                .pps = 1,
-                .bps = pckt->pkt_len,
-                .lastupdate = ts
-            };
+                rl = &rl_entries[pos];
+
+                rl_init(rl, lim, now);
 
-            rte_hash_add_key_data(rl_tbl, &iph->src_addr, &newrl);
+                rte_hash_add_key_with_hash_data(rl_tbl, &meta->src_ip[idx], sig, rl);
+            }
+            else if (pos >= 0)
+            {
+                // The table handed out a position beyond the entries (it never should), don't keep a key without an entry.
+                rte_hash_del_key_with_hash(rl_tbl, &meta->src_ip[idx], sig);
+            }
         }
 #ifdef DEBUG
         else
@@ -226,54 +627,50 @@ static void inspect_pckt(struct rte_mbuf *pckt, unsigned port_id, void *rl_tbl,
             printf("LRU recyle failed.\n");
         }
 #endif
-    }
-
-    // Swap MAC addresses.
-    swap_eth(eth);
 
-    // Swap IP addresses.
-    swap_iph(iph);
+    }
 
-    // Recalculate IP header checksum.
-    iph->hdr_checksum = 0;
-    rte_ipv4_cksum(iph);
+    // Sources we're unable to track are only limited by their subnets.
+    if (rl == NULL)
+    {
+        stats_untracked(st);
+    }
 
-    // Swap TCP or UDP ports and recalculate checksum.
-    if (iph->next_proto_id == PROTOCOL_TCP)
+    switch ((rl != NULL) ? rl_police(rl, lim, now, tsc, pckt->pkt_len) : RTE_COLOR_GREEN)
     {
-        // Initialize TCP header.
-        struct rte_tcp_hdr *tcph = data + offset;
+        case RTE_COLOR_RED:
+            // The source's own limit dropped the packet, refund its subnets.
+            for (t = 0; t < RL_NB_TIERS; t++)
+            {
+                if (prefixes[t] != NULL)
+                {
+                    rl_tier_refund(&tiers[t], prefixes[t], pckt->pkt_len);
+                }
+            }
 
-        // Swap TCP ports.
-        swap_tcph(tcph);
+            // Free packet's mbuf back to memory pool.
+            rte_pktmbuf_free(pckt);
 
-        // Recalculate checksum.
-        rte_ipv4_udptcp_cksum(iph, tcph);
-    }
-    else if (iph->next_proto_id == PROTOCOL_UDP)
-    {
-        // Initialize UDP header.
-        struct rte_udp_hdr *udph = data + offset;
+            // Increment drop counter.
+            stats_drop(st, DROP_RATE_LIMIT);
+
+#ifdef DEBUG
+            printf("Dropping packet due to rate limit!\n");
+#endif
 
-        // Swap UDP ports.
-        swap_udph(udph);
+            return 0;
 
-        // Recalculate checksum.
-        rte_ipv4_udptcp_cksum(iph, udph);   
-    }
+        case RTE_COLOR_YELLOW:
+            // Demote the packet by remarking its DSCP (the ECN bits are kept).
+            ipv4_set_dscp(rte_pktmbuf_mtod_offset(pckt, struct rte_ipv4_hdr *, meta->l3_off[idx]), lim->yellow_dscp);
 
-    // Otherwise, forward packet.
-    unsigned dst_port;
-    struct rte_eth_dev_tx_buffer *buffer;
+            break;
 
-    // Retrieve what port we're going out of and TX buffer to use.
-    dst_port = ports[port_id].tx_port;
-    buffer = ports[dst_port].tx_buffer;
-    
-    rte_eth_tx_buffer(dst_port, 0, buffer, pckt);
+        default:
+            break;
+    }
 
-    // Increment packets TX count.
-    pckts_forwarded++;
+    return 1;
 }
 
 /**
@@ -284,10 +681,16 @@ static void inspect_pckt(struct rte_mbuf *pckt, unsigned port_id, void *rl_tbl,
 static void pckt_loop(void)
 {
     // An array of packets witin burst.
-    struct rte_mbuf *pckts_burst[packet_burst_size];
+    struct rte_mbuf *pckts_burst[PARSE_MAX_BURST];
+
+    // The parsed headers of the burst.
+    struct parse_meta meta;
 
-    // Single mbuf we'll use to inspect.
-    struct rte_mbuf *pckt;
+    // The packets of the burst to send back.
+    struct reflect_list refl;
+
+    // The parser handles at most PARSE_MAX_BURST packets at once.
+    const unsigned burst_size = RTE_MIN(packet_burst_size, PARSE_MAX_BURST);
 
     // Retrieve the l-core ID.
     unsigned lcore_id = rte_lcore_id();
@@ -300,22 +703,22 @@ static void pckt_loop(void)
     unsigned port_id;
     unsigned nb_rx;
 
-    // The specific RX queue config for the l-core.
-    struct lcore_port_conf *qconf = &lcore_port_conf[lcore_id];
+    // The specific RX/TX queue config for the l-core.
+    struct lcore_queue_conf *qconf = &lcore_queue_conf[lcore_id];
+
+    // The l-core's own counters.
+    struct lcore_stats *st = &lcore_stats[lcore_id];
 
     // For TX draining.
     const __u64 draintsc = (rte_get_tsc_hz() + US_PER_S - 1) / US_PER_S * BURST_TX_DRAIN_US;
 
-    // Pointer to TX buffer.
-    struct rte_eth_dev_tx_buffer *buffer;
-
     // Create timer variables.
     __u64 prevtsc = 0;
     __u64 difftsc;
     __u64 curtsc;
 
     // If we have no RX ports under this l-core, return because the l-core has nothing else to do.
-    if (qconf->num_rx_ports == 0)
+    if (qconf->num_rx_queues == 0)
     {
         RTE_LOG(INFO, USER1, "lcore %u has nothing to do.\n", lcore_id);
 
@@ -323,10 +726,13 @@ static void pckt_loop(void)
     }
 
     // Log message.
-    RTE_LOG(INFO, USER1, "Looping lcore %u with %u RX ports/queues.\n", lcore_id, qconf->num_rx_ports);
+    RTE_LOG(INFO, USER1, "Looping lcore %u with %u RX queues (TX queue %u).\n", lcore_id, qconf->num_rx_queues, qconf->tx_queue_id);
 
-    // Retrieve rate limit table.
-    void *rl_tbl = rte_hash_find_existing("rate_limits");
+    // Retrieve this l-core's rate limit table. Each l-core has its own table so l-cores never contend on entries.
+    char name[64];
+    snprintf(name, sizeof(name), "rate_limits_%u", lcore_id);
+
+    void *rl_tbl = rte_hash_find_existing(name);
 
     if (rl_tbl == NULL)
     {
@@ -335,9 +741,45 @@ static void pckt_loop(void)
         return;
     }
 
-    // To prevent shared access to global PPS and BPS command line variables, we'll store these in seperate local variables.
-    __u64 pps = cmd.pps;
-    __u64 bps = cmd.bps;
+    // The entries the table points to, one per position within the table.
+    struct rate_limit *rl_entries = rte_zmalloc_socket("rate_limit_entries", MAX_TABLE_SIZE * sizeof(struct rate_limit), RTE_CACHE_LINE_SIZE, rte_socket_id());
+
+    if (rl_entries == NULL)
+    {
+        rte_exit(EXIT_FAILURE, "Unable to allocate rate limit entries on l-core %u.\n", lcore_id);
+
+        return;
+    }
+
+    // Compute the token bucket parameters and meter profiles once, so the datapath never divides. This also keeps the l-cores from sharing the command line variables.
+    struct rl_limits lim;
+
+    memset(&lim, 0, sizeof(lim));
+
+    rl_bucket_init(&lim.pps, cmd.pps, cmd.pps_burst);
+    rl_bucket_init(&lim.bps, cmd.bps, cmd.bps_burst);
+
+    lim.meter = cmd.meter;
+    lim.yellow_dscp = cmd.yellow_dscp;
+
+    if (rl_meter_profiles(&lim.srtcm, &lim.trtcm) != 0)
+    {
+        rte_exit(EXIT_FAILURE, "Invalid meter parameters on l-core %u.\n", lcore_id);
+
+        return;
+    }
+
+    const unsigned use_ptype = cmd.hwmeta;
+
+    // Start out trusting the RSS hashes of the ports that deliver ones we can reproduce.
+    struct rl_rss rss;
+
+    memset(&rss, 0, sizeof(rss));
+
+    for (i = 0; i < RTE_MAX_ETHPORTS; i++)
+    {
+        rss.trusted[i] = (queues_hw_meta[i] & QUEUES_HW_RSS) != 0;
+    }
 
     // Create while loop relying on quit variable.
     while (!quit)
@@ -351,18 +793,12 @@ static void pckt_loop(void)
         // Check if we need to send packets out the buffer.
         if (unlikely(difftsc > draintsc))
         {
-            // Loop through all TX ports.
+            // Loop through all TX ports and send packets in our own buffer out our own TX queue.
             for (i = 0; i < qconf->num_tx_ports; i++)
             {
-                // Retrieve correct port_id and buffer.
-                port_id = ports[qconf->rx_port_list[i]].tx_port;
-                buffer = ports[port_id].tx_buffer;
+                port_id = qconf->tx_port_list[i];
 
-                // Loop through each TX queue and send packets in buffer.
-                for (j = 0; j < tx_queue_pp; j++)
-                {
-                    rte_eth_tx_buffer_flush(port_id, j, buffer);
-                }
+                rte_eth_tx_buffer_flush(port_id, qconf->tx_queue_id, qconf->tx_buffers[port_id]);
             }
 
             // Assign prevtsc.
@@ -370,26 +806,39 @@ static void pckt_loop(void)
         }
 
         // Read all packets from RX queue.
-        for (i = 0; i < qconf->num_rx_ports; i++)
+        for (i = 0; i < qconf->num_rx_queues; i++)
         {
             // Retrieve correct port ID.
-            port_id = qconf->rx_port_list[i];
+            port_id = qconf->rx_queues[i].port_id;
 
             // Burst RX which will assign nb_rx to the amount of packets we have from the RX queue.
-            nb_rx = rte_eth_rx_burst(port_id, 0, pckts_burst, packet_burst_size);
+            nb_rx = rte_eth_rx_burst(port_id, qconf->rx_queues[i].queue_id, pckts_burst, burst_size);
+
+            // Parse the headers of the whole burst at once.
+            parse_burst(pckts_burst, nb_rx, &meta, use_ptype);
+
+            // Every packet of the burst is rate limited with the same timestamp.
+            __u64 tsc = rte_rdtsc();
+            __u64 now = RTE_MAX(tsc, rl_starttsc) - rl_starttsc;
+
+            // Loop through the amount of packets we have from the RX queue and inspect each one.
+            refl.nb = 0;
 
-            // Loop through the amount of packets we have from the RX queue.
             for (j = 0; j < nb_rx; j++)
             {
-                // Assign the individual packet mbuf.
-                pckt = pckts_burst[j];
+                if (inspect_pckt(pckts_burst[j], &meta, j, port_id, &rss, st, rl_tbl, rl_entries, &lim, rl_tiers, now, tsc))
+                {
+                    reflect_list_add(&refl, pckts_burst[j], &meta, j);
+                }
+            }
 
-                // Prefetch the packet.
-                rte_prefetch0(rte_pktmbuf_mtod(pckt, void *));
+            // Swap the MAC and IP addresses along with the TCP/UDP ports of the remaining packets (their checksums stay valid) and send them out our own TX queue.
+            reflect_burst(refl.eths, refl.iphs, refl.l4hs, refl.nb);
 
-                // Lastly, inspect the packet.
-                inspect_pckt(pckt, port_id, rl_tbl, pps, bps);
-            }
+            // Increment packets TX count before handing them over (packets the TX queue has no room for are moved to the drops).
+            stats_fwd_bulk(st, refl.nb);
+
+            queues_tx_burst(qconf, ports[port_id].tx_port, refl.pckts, refl.nb);
         }
     }
 }
@@ -418,39 +867,6 @@ static void sign_hdl(int tmp)
     quit = 1;
 }
 
-/**
- * The stats thread handler.
- * 
- * @param tmp An unused variable.
- * 
- * @return Void
-**/
-void *hndl_stats(void *tmp)
-{
-    // Last updated variables.
-    __u64 last_fwd = 0;
-    __u64 last_drop = 0;
-
-    // Run until program exits.
-    while (!quit)
-    {
-        // Retrieve current PPS.
-        __u64 fwd_pps = pckts_forwarded - last_fwd;
-        __u64 drop_pps = pckts_dropped - last_drop;
-
-        // Flush stdout and print stats.
-        fflush(stdout);
-        printf("\rForward => %llu. Drop => %llu.", fwd_pps, drop_pps);
-
-        // Update last variables.
-        last_fwd = pckts_forwarded;
-        last_drop = pckts_dropped;
-
-        // Sleep for a second to avoid unnecessary CPU cycles.
-        sleep(1);
-    }
-}
-
 /**
  * The main function call.
  * 
@@ -484,8 +900,38 @@ int main(int argc, char **argv)
     // Parse application-specific arguments.
     parsecmdline((struct cmdline *)&cmd, argc, argv);
 
-    // Print PPS and BPS set.
-    printf("PPS Limit => %llu.\nBPS Limit => %llu.\n", cmd.pps, cmd.bps);
+    // Print the limits set.
+    if (cmd.meter == CMDLINE_METER_SRTCM)
+    {
+        printf("srTCM Meter => CIR %llu, CBS %llu, EBS %llu (yellow DSCP %u).\n", cmd.cir, cmd.cbs ? cmd.cbs : cmd.cir, cmd.ebs ? cmd.ebs : cmd.cir, cmd.yellow_dscp);
+    }
+    else if (cmd.meter == CMDLINE_METER_TRTCM)
+    {
+        printf("trTCM Meter => CIR %llu, PIR %llu, CBS %llu, PBS %llu (yellow DSCP %u).\n", cmd.cir, cmd.pir, cmd.cbs ? cmd.cbs : cmd.cir, cmd.pbs ? cmd.pbs : cmd.pir, cmd.yellow_dscp);
+    }
+    else
+    {
+        printf("PPS Limit => %llu (burst %llu).\nBPS Limit => %llu (burst %llu).\n", cmd.pps, cmd.pps_burst ? cmd.pps_burst : cmd.pps, cmd.bps, cmd.bps_burst ? cmd.bps_burst : cmd.bps);
+    }
+
+    if (cmd.pps24 || cmd.bps24)
+    {
+        printf("/24 Limit => %llu PPS, %llu BPS.\n", cmd.pps24, cmd.bps24);
+    }
+
+    if (cmd.pps16 || cmd.bps16)
+    {
+        printf("/16 Limit => %llu PPS, %llu BPS.\n", cmd.pps16, cmd.bps16);
+    }
+
+    // Make sure the meter parameters are valid before setting anything up.
+    struct rte_meter_srtcm_profile srtcm;
+    struct rte_meter_trtcm_profile trtcm;
+
+    if (rl_meter_profiles(&srtcm, &trtcm) != 0)
+    {
+        rte_exit(EXIT_FAILURE, "Invalid meter parameters (the CIR and PIR must be above 0 and the PIR at least the CIR).\n");
+    }
 
     // Retrieve amount of l-cores.
     ret = dpdkc_get_available_lcore_count();
@@ -513,26 +959,23 @@ int main(int argc, char **argv)
     // Populate our destination ports.
     dpdkc_populate_dst_ports();
 
-    // Initialize mbuf pool.
-    ret = dpdkc_create_mbuf();
-
-    dpdkc_check_ret(&ret);
-
-    // Initialize each port.
-    ret = dpdkc_ports_queues_init(cmd.promisc, 1, 1);
-
-    // Check for error and fail with it if there is.
-    dpdkc_check_ret(&ret);
-
-    // Initialize the port and l-core mappings.
-    ret = dpdkc_ports_queues_mapping();
+    // Select the widest header swap kernel the CPU supports.
+    printf("Reflecting packets with the %s kernel.\n", reflect_kernel_name(reflect_init()));
 
-    dpdkc_check_ret(&ret);
+    // Initialize the mbuf pool and each port with the amount of RX/TX queues specified. RSS always spreads packets by their source address, so every packet of a source IP goes to the same l-core and its limits hold no matter how many queues are used.
+    int nb_ports = queues_ports_init(cmd.promisc, cmd.queues, cmd.hwmeta, RL_RSS_HF);
 
     // Check for available ports.
-    ret = dpdkc_ports_available();
+    if (nb_ports <= 0)
+    {
+        rte_exit(EXIT_FAILURE, "Failed to initialize ports or all available ports are disabled (%d).\n", nb_ports);
+    }
 
-    dpdkc_check_ret(&ret);
+    // Map RX/TX queue N of each port to l-core N.
+    if (queues_lcores_init(cmd.queues) != 0)
+    {
+        rte_exit(EXIT_FAILURE, "Failed to map %u queues to l-cores (make sure there's at least one l-core per queue).\n", cmd.queues);
+    }
 
     // Check port link status for all ports.
     dpdkc_check_link_status();
@@ -542,26 +985,47 @@ int main(int argc, char **argv)
     {
         pthread_t pid;
 
-        pthread_create(&pid, NULL, hndl_stats, NULL);
+        pthread_create(&pid, NULL, stats_hndl, NULL);
     }
 
-    // Create rate limits table.
-    struct rte_hash_parameters hparams =
+    // Create a rate limits table for each l-core that polls queues.
+    unsigned lcore_id;
+
+    RTE_LCORE_FOREACH(lcore_id)
     {
-        .name = "rate_limits",
-        .key_len = sizeof(__u32),
-        .entries = MAX_TABLE_SIZE,
-        .hash_func = rte_jhash,
-        .socket_id = rte_socket_id()
-    };
-     
-    void *rl_tbl = rte_hash_create(&hparams);
+        if (lcore_queue_conf[lcore_id].num_rx_queues == 0)
+        {
+            continue;
+        }
 
-    if (rl_tbl == NULL)
+        char name[64];
+        snprintf(name, sizeof(name), "rate_limits_%u", lcore_id);
+
+        struct rte_hash_parameters hparams =
+        {
+            .name = name,
+            .key_len = sizeof(__u32),
+            .entries = MAX_TABLE_SIZE,
+            .hash_func = cmd.hwmeta ? rl_rss_hash : rte_jhash,
+            .socket_id = rte_lcore_to_socket_id(lcore_id)
+        };
+        
+        void *rl_tbl = rte_hash_create(&hparams);
+
+        if (rl_tbl == NULL)
+        {
+            rte_exit(EXIT_FAILURE, "Failed to create rate limits table for l-core %u.\n", lcore_id);
+        }
+    }
+
+    // The subnet tiers, each with a table sized by how many subnets of its prefix length are expected to be busy at once. The tables are shared by all l-cores, so a subnet's budget holds no matter which queues its hosts land on.
+    if (rl_tier_init(&rl_tiers[0], 24, RL_TIER24_SETS, cmd.pps24, cmd.bps24) != 0 || rl_tier_init(&rl_tiers[1], 16, RL_TIER16_SETS, cmd.pps16, cmd.bps16) != 0)
     {
-        rte_exit(EXIT_FAILURE, "Failed to create rate limits table.\n");
+        rte_exit(EXIT_FAILURE, "Failed to allocate subnet rate limit tables.\n");
     }
 
+    rl_starttsc = rte_rdtsc();
+
     // Launch the application on each l-core.
     dpdkc_launch_and_run(launch_lcore);
 
@@ -575,7 +1039,7 @@ int main(int argc, char **argv)
 
     dpdkc_check_ret(&ret);
 
-    printf("Total Packets Forwarded => %llu.\nTotal Packets Dropped => %llu.\n\n", pckts_forwarded, pckts_dropped);
+    stats_print_totals();
 
     return 0;
 }
\ No newline at end of file
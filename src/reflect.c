@@ -0,0 +1,306 @@
+#include <stddef.h>
+#include <string.h>
+
+#include <rte_cpuflags.h>
+#include <rte_vect.h>
+
+#include "reflect.h"
+
+#ifdef RTE_ARCH_X86
+// Byte shuffles (in _mm_set_epi8() order) swapping the MAC addresses within the first 16 bytes of an ethernet header and the IP addresses and ports within the 16 bytes starting at the source address of an IPv4 header without options. The trailing bytes are written back unchanged.
+#define REFLECT_ETH_MASK 15, 14, 13, 12, 5, 4, 3, 2, 1, 0, 11, 10, 9, 8, 7, 6
+#define REFLECT_L3L4_MASK 15, 14, 13, 12, 9, 8, 11, 10, 3, 2, 1, 0, 7, 6, 5, 4
+
+// The 16 bytes starting at an IPv4 header's source address.
+#define REFLECT_L3L4(iph) ((__m128i *)((__u8 *)(iph) + offsetof(struct rte_ipv4_hdr, src_addr)))
+#endif
+
+/**
+ * Swaps the source and destination MAC addresses of an ethernet header.
+ * 
+ * @param eth A pointer to the ethernet header.
+ * 
+ * @return Void
+**/
+static inline void reflect_eth(struct rte_ether_hdr *eth)
+{
+    struct rte_ether_addr tmp;
+
+    rte_ether_addr_copy(&eth->src_addr, &tmp);
+    rte_ether_addr_copy(&eth->dst_addr, &eth->src_addr);
+    rte_ether_addr_copy(&tmp, &eth->dst_addr);
+}
+
+/**
+ * Swaps the source and destination addresses of an IPv4 header. They're adjacent, so rotating them as a single 64-bit word by half its width swaps them in either byte order.
+ * 
+ * @param iph A pointer to the IPv4 header.
+ * 
+ * @return Void
+**/
+static inline void reflect_ipv4(struct rte_ipv4_hdr *iph)
+{
+    __u64 addrs;
+
+    memcpy(&addrs, &iph->src_addr, sizeof(addrs));
+
+    addrs = (addrs << 32) | (addrs >> 32);
+
+    memcpy(&iph->src_addr, &addrs, sizeof(addrs));
+}
+
+/**
+ * Swaps the source and destination ports of a TCP or UDP header (both start with the two ports).
+ * 
+ * @param l4h A pointer to the TCP or UDP header.
+ * 
+ * @return Void
+**/
+static inline void reflect_l4(void *l4h)
+{
+    __u32 ports;
+
+    memcpy(&ports, l4h, sizeof(ports));
+
+    ports = (ports << 16) | (ports >> 16);
+
+    memcpy(l4h, &ports, sizeof(ports));
+}
+
+/**
+ * Checks whether the TCP/UDP header directly follows an IPv4 header without options, so the addresses and ports can be swapped with a single shuffle.
+ * 
+ * @param iph A pointer to the IPv4 header.
+ * @param l4h A pointer to the TCP/UDP header (or NULL).
+ * 
+ * @return 1 if the headers are contiguous or 0 otherwise.
+**/
+static inline int reflect_l3l4_contiguous(const struct rte_ipv4_hdr *iph, const void *l4h)
+{
+    return l4h == (const __u8 *)iph + sizeof(struct rte_ipv4_hdr);
+}
+
+/**
+ * The scalar kernel, swapping each header one packet at a time.
+ * 
+ * @param eths A pointer to the array of ethernet headers.
+ * @param iphs A pointer to the array of IPv4 headers.
+ * @param l4hs A pointer to the array of TCP/UDP headers (NULL entries for packets without one).
+ * @param nb The amount of packets.
+ * 
+ * @return Void
+**/
+static void reflect_burst_scalar(struct rte_ether_hdr **eths, struct rte_ipv4_hdr **iphs, void **l4hs, unsigned nb)
+{
+    unsigned i;
+
+    for (i = 0; i < nb; i++)
+    {
+        reflect_eth(eths[i]);
+        reflect_ipv4(iphs[i]);
+
+        if (l4hs[i] != NULL)
+        {
+            reflect_l4(l4hs[i]);
+        }
+    }
+}
+
+#ifdef RTE_ARCH_X86
+/**
+ * The SSSE3 kernel. Each packet's MAC addresses are swapped with a single shuffle, as are its IP addresses and ports when the IPv4 header has no options (the usual case).
+ * 
+ * @param eths A pointer to the array of ethernet headers.
+ * @param iphs A pointer to the array of IPv4 headers.
+ * @param l4hs A pointer to the array of TCP/UDP headers (NULL entries for packets without one).
+ * @param nb The amount of packets.
+ * 
+ * @return Void
+**/
+static __attribute__((target("ssse3"))) void reflect_burst_ssse3(struct rte_ether_hdr **eths, struct rte_ipv4_hdr **iphs, void **l4hs, unsigned nb)
+{
+    const __m128i eth_mask = _mm_set_epi8(REFLECT_ETH_MASK);
+    const __m128i l3l4_mask = _mm_set_epi8(REFLECT_L3L4_MASK);
+    unsigned i;
+
+    for (i = 0; i < nb; i++)
+    {
+        __m128i *eth = (__m128i *)eths[i];
+
+        _mm_storeu_si128(eth, _mm_shuffle_epi8(_mm_loadu_si128(eth), eth_mask));
+
+        if (reflect_l3l4_contiguous(iphs[i], l4hs[i]))
+        {
+            __m128i *addrs = REFLECT_L3L4(iphs[i]);
+
+            _mm_storeu_si128(addrs, _mm_shuffle_epi8(_mm_loadu_si128(addrs), l3l4_mask));
+
+            continue;
+        }
+
+        reflect_ipv4(iphs[i]);
+
+        if (l4hs[i] != NULL)
+        {
+            reflect_l4(l4hs[i]);
+        }
+    }
+}
+
+/**
+ * The AVX2 kernel. The headers of two packets are loaded into the lanes of a single register and swapped with one shuffle. Pairs where either IPv4 header has options and an odd packet at the end go through the SSSE3 kernel.
+ * 
+ * @param eths A pointer to the array of ethernet headers.
+ * @param iphs A pointer to the array of IPv4 headers.
+ * @param l4hs A pointer to the array of TCP/UDP headers (NULL entries for packets without one).
+ * @param nb The amount of packets.
+ * 
+ * @return Void
+**/
+static __attribute__((target("avx2"))) void reflect_burst_avx2(struct rte_ether_hdr **eths, struct rte_ipv4_hdr **iphs, void **l4hs, unsigned nb)
+{
+    const __m256i eth_mask = _mm256_set_epi8(REFLECT_ETH_MASK, REFLECT_ETH_MASK);
+    const __m256i l3l4_mask = _mm256_set_epi8(REFLECT_L3L4_MASK, REFLECT_L3L4_MASK);
+    unsigned i;
+
+    for (i = 0; i + 1 < nb; i += 2)
+    {
+        if (!reflect_l3l4_contiguous(iphs[i], l4hs[i]) || !reflect_l3l4_contiguous(iphs[i + 1], l4hs[i + 1]))
+        {
+            reflect_burst_ssse3(&eths[i], &iphs[i], &l4hs[i], 2);
+
+            continue;
+        }
+
+        __m128i *eth0 = (__m128i *)eths[i];
+        __m128i *eth1 = (__m128i *)eths[i + 1];
+        __m128i *addrs0 = REFLECT_L3L4(iphs[i]);
+        __m128i *addrs1 = REFLECT_L3L4(iphs[i + 1]);
+
+        __m256i hdrs = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128(eth0)), _mm_loadu_si128(eth1), 1);
+
+        hdrs = _mm256_shuffle_epi8(hdrs, eth_mask);
+
+        _mm_storeu_si128(eth0, _mm256_castsi256_si128(hdrs));
+        _mm_storeu_si128(eth1, _mm256_extracti128_si256(hdrs, 1));
+
+        hdrs = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128(addrs0)), _mm_loadu_si128(addrs1), 1);
+
+        hdrs = _mm256_shuffle_epi8(hdrs, l3l4_mask);
+
+        _mm_storeu_si128(addrs0, _mm256_castsi256_si128(hdrs));
+        _mm_storeu_si128(addrs1, _mm256_extracti128_si256(hdrs, 1));
+    }
+
+    if (i < nb)
+    {
+        reflect_burst_ssse3(&eths[i], &iphs[i], &l4hs[i], 1);
+    }
+}
+#endif
+
+static const struct
+{
+    const char *name;
+    reflect_burst_t fn;
+} reflect_kernels[REFLECT_MAX_KERNEL] =
+{
+    [REFLECT_SCALAR] = {"scalar", reflect_burst_scalar},
+#ifdef RTE_ARCH_X86
+    [REFLECT_SSSE3] = {"ssse3", reflect_burst_ssse3},
+    [REFLECT_AVX2] = {"avx2", reflect_burst_avx2},
+#else
+    [REFLECT_SSSE3] = {"ssse3", NULL},
+    [REFLECT_AVX2] = {"avx2", NULL},
+#endif
+};
+
+reflect_burst_t reflect_burst_fn = reflect_burst_scalar;
+
+/**
+ * Retrieves the name of a kernel.
+ * 
+ * @param kernel The kernel.
+ * 
+ * @return The kernel's name.
+**/
+const char *reflect_kernel_name(enum reflect_kernel kernel)
+{
+    if (kernel >= REFLECT_MAX_KERNEL)
+    {
+        return "unknown";
+    }
+
+    return reflect_kernels[kernel].name;
+}
+
+/**
+ * Checks whether the CPU is able to run a kernel.
+ * 
+ * @param kernel The kernel.
+ * 
+ * @return 1 if the kernel is supported or 0 otherwise.
+**/
+int reflect_kernel_supported(enum reflect_kernel kernel)
+{
+    if (kernel >= REFLECT_MAX_KERNEL || reflect_kernels[kernel].fn == NULL)
+    {
+        return 0;
+    }
+
+    switch (kernel)
+    {
+#ifdef RTE_ARCH_X86
+        case REFLECT_SSSE3:
+            return rte_cpu_get_flag_enabled(RTE_CPUFLAG_SSSE3) > 0;
+
+        case REFLECT_AVX2:
+            // The AVX2 kernel falls back to the SSSE3 one.
+            return rte_cpu_get_flag_enabled(RTE_CPUFLAG_AVX2) > 0 && rte_cpu_get_flag_enabled(RTE_CPUFLAG_SSSE3) > 0;
+#endif
+
+        default:
+            return 1;
+    }
+}
+
+/**
+ * Selects the kernel reflect_burst() uses.
+ * 
+ * @param kernel The kernel.
+ * 
+ * @return 0 on success or -1 if the CPU doesn't support the kernel.
+**/
+int reflect_select(enum reflect_kernel kernel)
+{
+    if (!reflect_kernel_supported(kernel))
+    {
+        return -1;
+    }
+
+    reflect_burst_fn = reflect_kernels[kernel].fn;
+
+    return 0;
+}
+
+/**
+ * Selects the widest kernel the CPU supports.
+ * 
+ * @return The kernel selected.
+**/
+enum reflect_kernel reflect_init(void)
+{
+    int kernel;
+
+    for (kernel = REFLECT_MAX_KERNEL - 1; kernel > REFLECT_SCALAR; kernel--)
+    {
+        if (reflect_select(kernel) == 0)
+        {
+            return kernel;
+        }
+    }
+
+    reflect_select(REFLECT_SCALAR);
+
+    return REFLECT_SCALAR;
+}
@@ -0,0 +1,78 @@
+#ifndef REFLECT_HEADER
+#define REFLECT_HEADER
+
+#include <linux/types.h>
+
+#include <rte_common.h>
+#include <rte_ether.h>
+#include <rte_ip.h>
+
+#include "parse.h"
+
+// Reflecting a packet back to where it came from only swaps the source and destination of each header. The one's complement sum doesn't depend on the order of the 16-bit words summed, so swapping the IP addresses (which are also part of the TCP/UDP pseudo-header) and the ports leaves both the IPv4 and TCP/UDP checksums valid as they are, no matter how large the payload is.
+
+// The packets of an RX burst to reflect along with pointers to their headers.
+struct reflect_list
+{
+    unsigned nb;
+    struct rte_mbuf *pckts[PARSE_MAX_BURST];
+    struct rte_ether_hdr *eths[PARSE_MAX_BURST];
+    struct rte_ipv4_hdr *iphs[PARSE_MAX_BURST];
+    void *l4hs[PARSE_MAX_BURST];
+};
+
+/**
+ * Adds an IPv4 packet of a parsed burst to a reflect list.
+ * 
+ * @param refl A pointer to the reflect list.
+ * @param pckt A pointer to the rte_mbuf container the packet data.
+ * @param meta A pointer to the parsed metadata of the packet's burst.
+ * @param idx The packet's index within the burst.
+ * 
+ * @return Void
+**/
+static inline void reflect_list_add(struct reflect_list *refl, struct rte_mbuf *pckt, const struct parse_meta *meta, unsigned idx)
+{
+    __u8 *data = rte_pktmbuf_mtod(pckt, __u8 *);
+
+    refl->pckts[refl->nb] = pckt;
+    refl->eths[refl->nb] = (struct rte_ether_hdr *)data;
+    refl->iphs[refl->nb] = (struct rte_ipv4_hdr *)(data + meta->l3_off[idx]);
+    refl->l4hs[refl->nb] = (meta->flags[idx] & PARSE_F_L4) ? data + meta->l4_off[idx] : NULL;
+    refl->nb++;
+}
+
+// The header swap kernels, selected at runtime by the CPU's flags.
+enum reflect_kernel
+{
+    REFLECT_SCALAR = 0,
+    REFLECT_SSSE3,
+    REFLECT_AVX2,
+    REFLECT_MAX_KERNEL
+};
+
+typedef void (*reflect_burst_t)(struct rte_ether_hdr **eths, struct rte_ipv4_hdr **iphs, void **l4hs, unsigned nb);
+
+// The selected kernel (the scalar one until reflect_init() or reflect_select() is called).
+extern reflect_burst_t reflect_burst_fn;
+
+/**
+ * Reflects a burst of IPv4 packets by swapping the source and destination MAC addresses, IP addresses and TCP/UDP ports with the selected kernel. The checksums are left unchanged since they stay valid.
+ * 
+ * @param eths A pointer to the array of ethernet headers.
+ * @param iphs A pointer to the array of IPv4 headers.
+ * @param l4hs A pointer to the array of TCP/UDP headers (NULL entries for packets without one, e.g. non-first fragments).
+ * @param nb The amount of packets.
+ * 
+ * @return Void
+**/
+static inline void reflect_burst(struct rte_ether_hdr **eths, struct rte_ipv4_hdr **iphs, void **l4hs, unsigned nb)
+{
+    reflect_burst_fn(eths, iphs, l4hs, nb);
+}
+
+const char *reflect_kernel_name(enum reflect_kernel kernel);
+int reflect_kernel_supported(enum reflect_kernel kernel);
+int reflect_select(enum reflect_kernel kernel);
+enum reflect_kernel reflect_init(void);
+#endif
@@ -0,0 +1,308 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <time.h>
+#include <linux/types.h>
+
+#include <rte_ether.h>
+#include <rte_ip.h>
+#include <rte_tcp.h>
+#include <rte_udp.h>
+
+#include "reflect.h"
+
+#define VERIFY_BURST 32
+#define VERIFY_PCKT_SIZE 2048
+#define VERIFY_MAX_PAYLOAD 1400
+
+#define DEFAULT_ITERATIONS 100000
+
+struct test_pckt
+{
+    __u8 data[VERIFY_PCKT_SIZE];
+    __u8 orig[VERIFY_PCKT_SIZE];
+    unsigned len;
+    unsigned l3_off;
+    unsigned l4_off;
+    __u8 proto;
+
+    // The packet is handed over without its TCP/UDP header (like a non-first fragment), so its ports must stay as they are.
+    unsigned no_l4 : 1;
+};
+
+/**
+ * Fills a buffer with random bytes.
+ * 
+ * @param buf A pointer to the buffer.
+ * @param len The buffer's length.
+ * 
+ * @return Void
+**/
+static void rand_bytes(void *buf, unsigned len)
+{
+    __u8 *b = buf;
+    unsigned i;
+
+    for (i = 0; i < len; i++)
+    {
+        b[i] = rand() & 0xFF;
+    }
+}
+
+/**
+ * Builds a random IPv4 TCP or UDP packet (optionally VLAN tagged and with IPv4 options) with valid checksums.
+ * 
+ * @param tp A pointer to the test packet.
+ * 
+ * @return Void
+**/
+static void build_pckt(struct test_pckt *tp)
+{
+    struct rte_ether_hdr *eth = (struct rte_ether_hdr *)tp->data;
+    unsigned offset = sizeof(struct rte_ether_hdr);
+
+    memset(tp->data, 0, sizeof(tp->data));
+
+    rand_bytes(eth, 2 * RTE_ETHER_ADDR_LEN);
+
+    if (rand() & 1)
+    {
+        struct rte_vlan_hdr *vlan = (struct rte_vlan_hdr *)(tp->data + offset);
+
+        eth->ether_type = rte_cpu_to_be_16(RTE_ETHER_TYPE_VLAN);
+        vlan->vlan_tci = rte_cpu_to_be_16(rand() & 0x0FFF);
+        vlan->eth_proto = rte_cpu_to_be_16(RTE_ETHER_TYPE_IPV4);
+
+        offset += sizeof(struct rte_vlan_hdr);
+    }
+    else
+    {
+        eth->ether_type = rte_cpu_to_be_16(RTE_ETHER_TYPE_IPV4);
+    }
+
+    tp->l3_off = offset;
+
+    // Half of the packets have between one and ten 32-bit words of options.
+    struct rte_ipv4_hdr *iph = (struct rte_ipv4_hdr *)(tp->data + offset);
+    unsigned ihl = (rand() & 1) ? 5 : 6 + rand() % 10;
+
+    tp->proto = (rand() & 1) ? IPPROTO_TCP : IPPROTO_UDP;
+
+    unsigned l4_len = (tp->proto == IPPROTO_TCP) ? sizeof(struct rte_tcp_hdr) : sizeof(struct rte_udp_hdr);
+    unsigned payload_len = rand() % (VERIFY_MAX_PAYLOAD + 1);
+
+    rand_bytes(iph, ihl * 4);
+
+    iph->version_ihl = 0x40 | ihl;
+    iph->fragment_offset = 0;
+    iph->next_proto_id = tp->proto;
+    iph->total_length = rte_cpu_to_be_16(ihl * 4 + l4_len + payload_len);
+
+    offset += ihl * 4;
+    tp->l4_off = offset;
+
+    rand_bytes(tp->data + offset, l4_len + payload_len);
+
+    if (tp->proto == IPPROTO_TCP)
+    {
+        struct rte_tcp_hdr *tcph = (struct rte_tcp_hdr *)(tp->data + offset);
+
+        tcph->data_off = 0x50;
+        tcph->cksum = 0;
+        tcph->cksum = rte_ipv4_udptcp_cksum(iph, tcph);
+    }
+    else
+    {
+        struct rte_udp_hdr *udph = (struct rte_udp_hdr *)(tp->data + offset);
+
+        udph->dgram_len = rte_cpu_to_be_16(l4_len + payload_len);
+        udph->dgram_cksum = 0;
+
+        // Some UDP packets go without a checksum, which must stay that way.
+        if (rand() % 8)
+        {
+            udph->dgram_cksum = rte_ipv4_udptcp_cksum(iph, udph);
+        }
+    }
+
+    iph->hdr_checksum = 0;
+    iph->hdr_checksum = rte_ipv4_cksum(iph);
+
+    tp->len = offset + l4_len + payload_len;
+    tp->no_l4 = (rand() % 8) == 0;
+
+    memcpy(tp->orig, tp->data, tp->len);
+}
+
+/**
+ * Checks a reflected packet against the original. The sources and destinations must be swapped, every other byte unchanged and the checksums must match a full recompute.
+ * 
+ * @param tp A pointer to the test packet.
+ * 
+ * @return 0 if the packet is correct or -1 otherwise.
+**/
+static int verify_pckt(struct test_pckt *tp)
+{
+    __u8 expect[VERIFY_PCKT_SIZE];
+
+    // Build the expected packet by swapping each field of the original byte by byte.
+    memcpy(expect, tp->orig, tp->len);
+
+    memcpy(expect, tp->orig + RTE_ETHER_ADDR_LEN, RTE_ETHER_ADDR_LEN);
+    memcpy(expect + RTE_ETHER_ADDR_LEN, tp->orig, RTE_ETHER_ADDR_LEN);
+
+    unsigned addrs = tp->l3_off + offsetof(struct rte_ipv4_hdr, src_addr);
+
+    memcpy(expect + addrs, tp->orig + addrs + 4, 4);
+    memcpy(expect + addrs + 4, tp->orig + addrs, 4);
+
+    if (!tp->no_l4)
+    {
+        memcpy(expect + tp->l4_off, tp->orig + tp->l4_off + 2, 2);
+        memcpy(expect + tp->l4_off + 2, tp->orig + tp->l4_off, 2);
+    }
+
+    if (memcmp(expect, tp->data, tp->len) != 0)
+    {
+        fprintf(stderr, "Reflected packet doesn't match the expected swap.\n");
+
+        return -1;
+    }
+
+    // The unchanged checksums must be what a full recompute gives.
+    struct rte_ipv4_hdr *iph = (struct rte_ipv4_hdr *)(tp->data + tp->l3_off);
+    __u16 cksum = iph->hdr_checksum;
+
+    iph->hdr_checksum = 0;
+
+    if (rte_ipv4_cksum(iph) != cksum)
+    {
+        fprintf(stderr, "IPv4 checksum 0x%04x doesn't match the recomputed 0x%04x.\n", cksum, rte_ipv4_cksum(iph));
+
+        return -1;
+    }
+
+    iph->hdr_checksum = cksum;
+
+    if (tp->proto == IPPROTO_TCP)
+    {
+        struct rte_tcp_hdr *tcph = (struct rte_tcp_hdr *)(tp->data + tp->l4_off);
+
+        cksum = tcph->cksum;
+        tcph->cksum = 0;
+
+        if (rte_ipv4_udptcp_cksum(iph, tcph) != cksum)
+        {
+            fprintf(stderr, "TCP checksum 0x%04x doesn't match the recomputed 0x%04x.\n", cksum, rte_ipv4_udptcp_cksum(iph, tcph));
+
+            return -1;
+        }
+
+        tcph->cksum = cksum;
+    }
+    else
+    {
+        struct rte_udp_hdr *udph = (struct rte_udp_hdr *)(tp->data + tp->l4_off);
+
+        cksum = udph->dgram_cksum;
+        udph->dgram_cksum = 0;
+
+        if (cksum != 0 && rte_ipv4_udptcp_cksum(iph, udph) != cksum)
+        {
+            fprintf(stderr, "UDP checksum 0x%04x doesn't match the recomputed 0x%04x.\n", cksum, rte_ipv4_udptcp_cksum(iph, udph));
+
+            return -1;
+        }
+
+        udph->dgram_cksum = cksum;
+    }
+
+    return 0;
+}
+
+/**
+ * Reflects bursts of random packets (of random sizes, so kernels working on pairs also see odd bursts) with the selected kernel and verifies every packet.
+ * 
+ * @param pckts A pointer to the array of VERIFY_BURST test packets.
+ * @param iterations The amount of bursts.
+ * 
+ * @return The amount of packets that failed.
+**/
+static unsigned long verify_kernel(struct test_pckt *pckts, unsigned long iterations)
+{
+    struct rte_ether_hdr *eths[VERIFY_BURST];
+    struct rte_ipv4_hdr *iphs[VERIFY_BURST];
+    void *l4hs[VERIFY_BURST];
+
+    unsigned long it;
+    unsigned long failed = 0;
+    unsigned i;
+
+    for (it = 0; it < iterations; it++)
+    {
+        unsigned nb = 1 + rand() % VERIFY_BURST;
+
+        for (i = 0; i < nb; i++)
+        {
+            build_pckt(&pckts[i]);
+
+            eths[i] = (struct rte_ether_hdr *)pckts[i].data;
+            iphs[i] = (struct rte_ipv4_hdr *)(pckts[i].data + pckts[i].l3_off);
+            l4hs[i] = pckts[i].no_l4 ? NULL : pckts[i].data + pckts[i].l4_off;
+        }
+
+        reflect_burst(eths, iphs, l4hs, nb);
+
+        for (i = 0; i < nb; i++)
+        {
+            if (verify_pckt(&pckts[i]) != 0)
+            {
+                failed++;
+            }
+        }
+    }
+
+    return failed;
+}
+
+/**
+ * The main function call. Reflects bursts of random packets with every kernel the CPU supports and verifies each packet against a full checksum recompute.
+ * 
+ * @param argc The amount of arguments.
+ * @param argv A pointer to the arguments array (the optional first argument is the amount of bursts per kernel and the second the random seed).
+ * 
+ * @return 0 if every packet was reflected correctly or 1 otherwise.
+**/
+int main(int argc, char **argv)
+{
+    static struct test_pckt pckts[VERIFY_BURST];
+
+    unsigned long iterations = (argc > 1) ? strtoul(argv[1], NULL, 0) : DEFAULT_ITERATIONS;
+    unsigned seed = (argc > 2) ? strtoul(argv[2], NULL, 0) : time(NULL);
+
+    unsigned long failed = 0;
+    int kernel;
+
+    srand(seed);
+
+    printf("Verifying %lu bursts of up to %u packets per kernel (seed %u).\n", iterations, VERIFY_BURST, seed);
+
+    for (kernel = REFLECT_SCALAR; kernel < REFLECT_MAX_KERNEL; kernel++)
+    {
+        if (reflect_select(kernel) != 0)
+        {
+            printf("%s => not supported by this CPU.\n", reflect_kernel_name(kernel));
+
+            continue;
+        }
+
+        unsigned long kfailed = verify_kernel(pckts, iterations);
+
+        printf("%s => %lu packets failed.\n", reflect_kernel_name(kernel), kfailed);
+
+        failed += kfailed;
+    }
+
+    return failed > 0;
+}
@@ -0,0 +1,210 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <linux/types.h>
+
+#include "routes.h"
+
+/**
+ * Compares two IPv4 snapshot routes by prefix length (shortest first).
+ * 
+ * @param a A pointer to the first route.
+ * @param b A pointer to the second route.
+ * 
+ * @return The comparison result.
+**/
+static int cmp_route(const void *a, const void *b)
+{
+    return (int)((const struct route_snapshot_route *)a)->depth - (int)((const struct route_snapshot_route *)b)->depth;
+}
+
+/**
+ * Compares two IPv6 snapshot routes by prefix length (shortest first).
+ * 
+ * @param a A pointer to the first route.
+ * @param b A pointer to the second route.
+ * 
+ * @return The comparison result.
+**/
+static int cmp_route6(const void *a, const void *b)
+{
+    return (int)((const struct route_snapshot_route6 *)a)->depth - (int)((const struct route_snapshot_route6 *)b)->depth;
+}
+
+/**
+ * The main function call. Compiles a routes file into a binary snapshot simple_l3fwd can memory map and bulk load at startup.
+ * 
+ * Usage: route_compile [routes file] [snapshot file]
+ * 
+ * @param argc The amount of arguments.
+ * @param argv A pointer to the arguments array.
+ * 
+ * @return Return code.
+**/
+int main(int argc, char **argv)
+{
+    const char *in = (argc > 1) ? argv[1] : ROUTES_FILE;
+    const char *out = (argc > 2) ? argv[2] : ROUTES_SNAPSHOT;
+
+    FILE *fp = fopen(in, "r");
+
+    if (!fp)
+    {
+        fprintf(stderr, "Failed to open routes file => %s (%s).\n", in, strerror(errno));
+
+        return EXIT_FAILURE;
+    }
+
+    struct next_hop nhs[MAX_NEXT_HOPS];
+    unsigned int nb_nhs = 0;
+
+    struct nh_group groups[MAX_NH_GROUPS];
+    unsigned int nb_groups = 0;
+
+    struct route_snapshot_route *routes = NULL;
+    struct route_snapshot_route6 *routes6 = NULL;
+    size_t nb_routes = 0, max_routes = 0;
+    size_t nb_routes6 = 0, max_routes6 = 0;
+
+    // Variables needed for looping through each line.
+    char *line = NULL;
+    size_t len = 0;
+    int i = 0;
+
+    // Go through each line.
+    while (getline(&line, &len, fp) != -1)
+    {
+        struct route_entry route;
+
+        // Increment I so we have an index.
+        i++;
+
+        if (routes_parse_line(line, i, &route) < 1)
+        {
+            continue;
+        }
+
+        // Retrieve the next hop (or next hop group) the prefix will point to.
+        int nh = routes_nh_value(nhs, &nb_nhs, groups, &nb_groups, &route);
+
+        if (nh < 0)
+        {
+            printf("WARNING - Route #%d failed due to next hop or group table being full (%d/%d max).\n", i, MAX_NEXT_HOPS, MAX_NH_GROUPS);
+
+            continue;
+        }
+
+        if (route.is_ipv6)
+        {
+            // Grow the array if needed.
+            if (nb_routes6 >= max_routes6)
+            {
+                max_routes6 = (max_routes6 > 0) ? max_routes6 * 2 : 1024;
+                routes6 = realloc(routes6, max_routes6 * sizeof(*routes6));
+
+                if (routes6 == NULL)
+                {
+                    fprintf(stderr, "Failed to allocate IPv6 routes array.\n");
+
+                    return EXIT_FAILURE;
+                }
+            }
+
+            struct route_snapshot_route6 *r = &routes6[nb_routes6++];
+
+            memset(r, 0, sizeof(*r));
+            memcpy(r->ip, route.ip6, sizeof(r->ip));
+            r->depth = route.depth;
+            r->nh = (__u16)nh;
+            r->vlan = route.vlan;
+        }
+        else
+        {
+            // Grow the array if needed.
+            if (nb_routes >= max_routes)
+            {
+                max_routes = (max_routes > 0) ? max_routes * 2 : 65536;
+                routes = realloc(routes, max_routes * sizeof(*routes));
+
+                if (routes == NULL)
+                {
+                    fprintf(stderr, "Failed to allocate IPv4 routes array.\n");
+
+                    return EXIT_FAILURE;
+                }
+            }
+
+            struct route_snapshot_route *r = &routes[nb_routes++];
+
+            memset(r, 0, sizeof(*r));
+            r->ip = route.ip;
+            r->depth = route.depth;
+            r->nh = (__u16)nh;
+            r->vlan = route.vlan;
+        }
+    }
+
+    free(line);
+    fclose(fp);
+
+    // Insert shorter prefixes first, so longer prefixes only overwrite their own range when loading instead of the LPM table checking depths on every entry.
+    qsort(routes, nb_routes, sizeof(*routes), cmp_route);
+    qsort(routes6, nb_routes6, sizeof(*routes6), cmp_route6);
+
+    struct route_snapshot_hdr hdr =
+    {
+        .magic = ROUTES_SNAPSHOT_MAGIC,
+        .version = ROUTES_SNAPSHOT_VERSION,
+        .nb_next_hops = nb_nhs,
+        .nb_routes = (__u32)nb_routes,
+        .nb_routes6 = (__u32)nb_routes6,
+        .nb_groups = nb_groups
+    };
+
+    // Write to a temporary file and rename it afterwards, so simple_l3fwd never maps a partially written snapshot.
+    char tmp[4096];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", out);
+
+    fp = fopen(tmp, "wb");
+
+    if (!fp)
+    {
+        fprintf(stderr, "Failed to open snapshot file => %s (%s).\n", tmp, strerror(errno));
+
+        return EXIT_FAILURE;
+    }
+
+    int ok = (fwrite(&hdr, sizeof(hdr), 1, fp) == 1);
+
+    for (unsigned int j = 0; ok && j < nb_nhs; j++)
+    {
+        struct route_snapshot_nh nh = {0};
+
+        rte_ether_addr_copy(&nhs[j].dmac, &nh.dmac);
+        nh.port = nhs[j].port;
+
+        ok = (fwrite(&nh, sizeof(nh), 1, fp) == 1);
+    }
+
+    ok = ok && (fwrite(groups, sizeof(*groups), nb_groups, fp) == nb_groups);
+    ok = ok && (fwrite(routes, sizeof(*routes), nb_routes, fp) == nb_routes);
+    ok = ok && (fwrite(routes6, sizeof(*routes6), nb_routes6, fp) == nb_routes6);
+
+    if (fclose(fp) != 0 || !ok || rename(tmp, out) != 0)
+    {
+        fprintf(stderr, "Failed to write snapshot file => %s (%s).\n", out, strerror(errno));
+
+        unlink(tmp);
+
+        return EXIT_FAILURE;
+    }
+
+    printf("Compiled %zu IPv4 routes, %zu IPv6 routes, %u next hops and %u next hop groups into %s.\n", nb_routes, nb_routes6, nb_nhs, nb_groups, out);
+
+    free(routes);
+    free(routes6);
+
+    return EXIT_SUCCESS;
+}
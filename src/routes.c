@@ -0,0 +1,385 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <arpa/inet.h>
+
+#include "routes.h"
+
+/**
+ * Parses an egress port number.
+ * 
+ * @param str The string to parse.
+ * @param port A pointer to store the port in.
+ * 
+ * @return 0 on success or -1 on error.
+**/
+static int routes_parse_port(const char *str, __u16 *port)
+{
+    char *end = NULL;
+    unsigned long val = strtoul(str, &end, 10);
+
+    if (end == str || *end != '\0' || val >= RTE_MAX_ETHPORTS)
+    {
+        return -1;
+    }
+
+    *port = (__u16)val;
+
+    return 0;
+}
+
+/**
+ * Parses a line in "<ip>[/<cidr>] <mac address>[@<port>][,<mac address>[@<port>]...] [egress port] [vlan=<id>]" format. The IP may either be an IPv4 or IPv6 address.
+ * 
+ * @param line The line to parse (this is modified).
+ * @param idx The line number (used for warnings).
+ * @param route A pointer to the route entry to fill.
+ * 
+ * @return 1 if a route was parsed, 0 if the line is empty or a comment or -1 on error.
+**/
+int routes_parse_line(char *line, int idx, struct route_entry *route)
+{
+    char ip[64];
+    char dmac[256];
+
+    memset(route, 0, sizeof(*route));
+
+    // Represents the part of the data we've split.
+    char *ptr = NULL;
+
+    ptr = strtok(line, " \t\r\n");
+
+    // Skip empty lines and comments.
+    if (ptr == NULL || *ptr == '#')
+    {
+        return 0;
+    }
+
+    // Copy the first part to IP.
+    snprintf(ip, sizeof(ip), "%s", ptr);
+
+    // Move onto the next.
+    ptr = strtok(NULL, " \t\r\n");
+
+    // Check.
+    if (ptr == NULL)
+    {
+        printf("WARNING - Route #%d failed due to trying to pick MAC address.\n", idx);
+
+        return -1;
+    }
+
+    // Copy MAC address.
+    snprintf(dmac, sizeof(dmac), "%s", ptr);
+
+    // IPv6 addresses always contain a colon.
+    route->is_ipv6 = (strchr(ip, ':') != NULL);
+
+    // Split the prefix length from the IP address. A route without a prefix length is a host (/32 or /128) route and a /0 route is the default route.
+    unsigned long max_depth = (route->is_ipv6) ? 128 : 32;
+    route->depth = (__u8)max_depth;
+    char *cidr = strchr(ip, '/');
+
+    if (cidr != NULL)
+    {
+        *cidr = '\0';
+
+        char *end = NULL;
+        unsigned long val = strtoul(cidr + 1, &end, 10);
+
+        if (end == cidr + 1 || *end != '\0' || val > max_depth)
+        {
+            printf("WARNING - Route #%d failed due to invalid prefix length (%s).\n", idx, cidr + 1);
+
+            return -1;
+        }
+
+        route->depth = (__u8)val;
+    }
+
+    // Convert IP address.
+    struct in_addr ipaddr;
+
+    // If inet_pton() returns anything other than 1, it failed.
+    if (inet_pton((route->is_ipv6) ? AF_INET6 : AF_INET, ip, (route->is_ipv6) ? (void *)route->ip6 : (void *)&ipaddr) != 1)
+    {
+        printf("WARNING - Route #%d failed due to IP address not parsing properly (%s).\n", idx, ip);
+
+        return -1;
+    }
+
+    if (!route->is_ipv6)
+    {
+        route->ip = ntohl(ipaddr.s_addr);
+    }
+
+    // The egress port is optional and applies to every next hop that doesn't name its own. The route may also be tagged with the VLAN whose VRF it belongs to.
+    __u16 port = NH_PORT_PAIRED;
+    int has_port = 0;
+
+    while ((ptr = strtok(NULL, " \t\r\n")) != NULL)
+    {
+        if (strncmp(ptr, "vlan=", 5) == 0)
+        {
+            char *end = NULL;
+            unsigned long val = strtoul(ptr + 5, &end, 10);
+
+            if (end == ptr + 5 || *end != '\0' || val >= MAX_VLANS)
+            {
+                printf("WARNING - Route #%d failed due to invalid VLAN (%s).\n", idx, ptr + 5);
+
+                return -1;
+            }
+
+            route->vlan = (__u16)val;
+
+            continue;
+        }
+
+        if (has_port || routes_parse_port(ptr, &port) != 0)
+        {
+            printf("WARNING - Route #%d failed due to invalid egress port (%s).\n", idx, ptr);
+
+            return -1;
+        }
+
+        has_port = 1;
+    }
+
+    // Now convert the MAC addresses. ECMP routes list several next hops separated by commas and each next hop may name its egress port after an '@'.
+    char *save = NULL;
+
+    for (ptr = strtok_r(dmac, ",", &save); ptr != NULL; ptr = strtok_r(NULL, ",", &save))
+    {
+        if (route->nb_paths >= MAX_ECMP_PATHS)
+        {
+            printf("WARNING - Route #%d failed due to too many next hops (%d max).\n", idx, MAX_ECMP_PATHS);
+
+            return -1;
+        }
+
+        struct route_path *path = &route->paths[route->nb_paths];
+        char *at = strchr(ptr, '@');
+
+        path->port = port;
+
+        if (at != NULL)
+        {
+            *at = '\0';
+
+            if (routes_parse_port(at + 1, &path->port) != 0)
+            {
+                printf("WARNING - Route #%d failed due to invalid egress port (%s).\n", idx, at + 1);
+
+                return -1;
+            }
+        }
+
+        struct rte_ether_addr *dmacval = &path->dmac;
+
+        if (sscanf(ptr, "%hhx:%hhx:%hhx:%hhx:%hhx:%hhx", &dmacval->addr_bytes[0], &dmacval->addr_bytes[1], &dmacval->addr_bytes[2], &dmacval->addr_bytes[3], &dmacval->addr_bytes[4], &dmacval->addr_bytes[5]) != 6)
+        {
+            printf("WARNING - Route #%d failed due to MAC address not parsing properly (%s).\n", idx, ptr);
+
+            return -1;
+        }
+
+        route->nb_paths++;
+    }
+
+    if (route->nb_paths == 0)
+    {
+        printf("WARNING - Route #%d failed due to trying to pick MAC address.\n", idx);
+
+        return -1;
+    }
+
+    return 1;
+}
+
+/**
+ * Retrieves the next hop index for a destination MAC address and egress port, adding it to the next hop table if it doesn't exist yet. The source MAC address is left for the caller to resolve.
+ * 
+ * @param nhs A pointer to the next hop table.
+ * @param nb_nhs A pointer to the amount of next hops within the table.
+ * @param max The maximum amount of next hops the table holds.
+ * @param dmac A pointer to the destination MAC address.
+ * @param port The egress port (or NH_PORT_PAIRED).
+ * 
+ * @return The next hop index or -1 if the next hop table is full.
+**/
+int routes_next_hop(struct next_hop *nhs, unsigned int *nb_nhs, unsigned int max, const struct rte_ether_addr *dmac, __u16 port)
+{
+    unsigned int i;
+
+    // Many prefixes usually share the same next hop, so reuse an existing entry if possible.
+    for (i = 0; i < *nb_nhs; i++)
+    {
+        if (nhs[i].port == port && rte_is_same_ether_addr(&nhs[i].dmac, dmac))
+        {
+            return i;
+        }
+    }
+
+    // Make sure we have room.
+    if (*nb_nhs >= max)
+    {
+        return -1;
+    }
+
+    memset(&nhs[*nb_nhs], 0, sizeof(nhs[*nb_nhs]));
+
+    rte_ether_addr_copy(dmac, &nhs[*nb_nhs].dmac);
+    nhs[*nb_nhs].port = port;
+
+    return (*nb_nhs)++;
+}
+
+/**
+ * Retrieves the value a route's LPM entry holds. Single path routes point to their next hop directly while ECMP routes point to a next hop group (flagged with NH_GROUP_FLAG), which is added to the group table if an identical group doesn't exist yet.
+ * 
+ * @param nhs A pointer to the next hop table (MAX_NEXT_HOPS entries).
+ * @param nb_nhs A pointer to the amount of next hops within the table.
+ * @param groups A pointer to the next hop group table (MAX_NH_GROUPS entries).
+ * @param nb_groups A pointer to the amount of groups within the table.
+ * @param route A pointer to the parsed route.
+ * 
+ * @return The LPM value or -1 if the next hop or group table is full.
+**/
+int routes_nh_value(struct next_hop *nhs, unsigned int *nb_nhs, struct nh_group *groups, unsigned int *nb_groups, const struct route_entry *route)
+{
+    struct nh_group grp;
+    unsigned int i;
+
+    memset(&grp, 0, sizeof(grp));
+
+    for (i = 0; i < route->nb_paths; i++)
+    {
+        int nh = routes_next_hop(nhs, nb_nhs, MAX_NEXT_HOPS, &route->paths[i].dmac, route->paths[i].port);
+
+        if (nh < 0)
+        {
+            return -1;
+        }
+
+        grp.nhs[grp.nb++] = (__u16)nh;
+    }
+
+    if (grp.nb == 1)
+    {
+        return grp.nhs[0];
+    }
+
+    // Routes towards the same set of parallel links share their group.
+    for (i = 0; i < *nb_groups; i++)
+    {
+        if (memcmp(&groups[i], &grp, sizeof(grp)) == 0)
+        {
+            return NH_GROUP_FLAG | i;
+        }
+    }
+
+    if (*nb_groups >= MAX_NH_GROUPS)
+    {
+        return -1;
+    }
+
+    groups[*nb_groups] = grp;
+
+    return NH_GROUP_FLAG | (*nb_groups)++;
+}
+
+/**
+ * Memory maps a binary route snapshot (created by route_compile) and validates it.
+ * 
+ * @param file Path to the snapshot file.
+ * @param snap A pointer to the snapshot structure to fill.
+ * 
+ * @return 0 on success or negative error code.
+**/
+int routes_snapshot_open(const char *file, struct route_snapshot *snap)
+{
+    struct stat st;
+    int ret = 0;
+
+    memset(snap, 0, sizeof(*snap));
+
+    int fd = open(file, O_RDONLY);
+
+    if (fd < 0)
+    {
+        return -errno;
+    }
+
+    if (fstat(fd, &st) != 0)
+    {
+        ret = -errno;
+
+        close(fd);
+
+        return ret;
+    }
+
+    if ((size_t)st.st_size < sizeof(struct route_snapshot_hdr))
+    {
+        close(fd);
+
+        return -EINVAL;
+    }
+
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+
+    // The mapping stays valid after closing the descriptor.
+    close(fd);
+
+    if (map == MAP_FAILED)
+    {
+        return -errno;
+    }
+
+    snap->map = map;
+    snap->size = st.st_size;
+    snap->hdr = map;
+
+    const struct route_snapshot_hdr *hdr = snap->hdr;
+
+    // Make sure this is a snapshot we understand and its arrays fit within the file.
+    size_t expected = sizeof(*hdr) + (size_t)hdr->nb_next_hops * sizeof(struct route_snapshot_nh) + (size_t)hdr->nb_groups * sizeof(struct nh_group) + (size_t)hdr->nb_routes * sizeof(struct route_snapshot_route) + (size_t)hdr->nb_routes6 * sizeof(struct route_snapshot_route6);
+
+    if (hdr->magic != ROUTES_SNAPSHOT_MAGIC || hdr->version != ROUTES_SNAPSHOT_VERSION || expected != snap->size)
+    {
+        routes_snapshot_close(snap);
+
+        return -EINVAL;
+    }
+
+    snap->nhs = (const void *)(hdr + 1);
+    snap->groups = (const void *)(snap->nhs + hdr->nb_next_hops);
+    snap->routes = (const void *)(snap->groups + hdr->nb_groups);
+    snap->routes6 = (const void *)(snap->routes + hdr->nb_routes);
+
+    return 0;
+}
+
+/**
+ * Unmaps a route snapshot.
+ * 
+ * @param snap A pointer to the snapshot structure.
+ * 
+ * @return Void
+**/
+void routes_snapshot_close(struct route_snapshot *snap)
+{
+    if (snap->map != NULL)
+    {
+        munmap(snap->map, snap->size);
+    }
+
+    memset(snap, 0, sizeof(*snap));
+}
@@ -0,0 +1,123 @@
+#ifndef ROUTES_HEADER
+#define ROUTES_HEADER
+
+#include <stddef.h>
+#include <linux/types.h>
+
+#include <rte_ether.h>
+
+#define ROUTES_FILE "/etc/l3fwd/routes.txt"
+#define ROUTES_SNAPSHOT "/etc/l3fwd/routes.bin"
+
+// Next hop indexes are 16-bit.
+#define MAX_NEXT_HOPS 1024
+
+// ECMP routes point to a next hop group instead of a single next hop. The group flag is stored within the LPM table's value along with the group index.
+#define MAX_ECMP_PATHS 7
+#define MAX_NH_GROUPS 4096
+#define NH_GROUP_FLAG 0x8000
+
+// Routes may be tagged with a VLAN ID to place them into that VLAN's VRF (0 is the default VRF).
+#define MAX_VLANS 4096
+
+// Next hops without an egress port go out the port paired with the RX port (--portmap).
+#define NH_PORT_PAIRED 0xFFFF
+
+// "L3FW" in ASCII.
+#define ROUTES_SNAPSHOT_MAGIC 0x4C334657
+#define ROUTES_SNAPSHOT_VERSION 4
+
+// A next hop holds the complete ethernet address rewrite along with the egress port. The destination and source MAC addresses are laid out like the ethernet header so they can be copied at once and each entry is 16 bytes (four per cache line).
+struct next_hop
+{
+    struct rte_ether_addr dmac;
+    struct rte_ether_addr smac;
+
+    __u16 port;
+    __u16 reserved;
+};
+
+// A group of equal cost next hops a flow hash picks from. This is 16 bytes (four per cache line).
+struct nh_group
+{
+    __u16 nb;
+    __u16 nhs[MAX_ECMP_PATHS];
+};
+
+struct route_path
+{
+    struct rte_ether_addr dmac;
+    __u16 port;
+};
+
+struct route_entry
+{
+    unsigned int is_ipv6 : 1;
+    __u8 depth;
+
+    // IPv4 addresses are stored in host byte order (as the LPM table expects), IPv6 addresses in network byte order.
+    __u32 ip;
+    __u8 ip6[16];
+
+    struct route_path paths[MAX_ECMP_PATHS];
+    __u8 nb_paths;
+
+    __u16 vlan;
+};
+
+// The snapshot file is a header followed by the next hops, next hop groups, IPv4 routes and IPv6 routes arrays. Every array entry is a multiple of four bytes so it can be used directly from the mapping.
+struct route_snapshot_hdr
+{
+    __u32 magic;
+    __u32 version;
+
+    __u32 nb_next_hops;
+    __u32 nb_routes;
+    __u32 nb_routes6;
+    __u32 nb_groups;
+};
+
+// The source MAC address depends on the machine's ports, so it's resolved when loading the snapshot.
+struct route_snapshot_nh
+{
+    struct rte_ether_addr dmac;
+    __u16 port;
+};
+
+// The route's nh is the value stored within the LPM table (a next hop index or NH_GROUP_FLAG with a group index).
+struct route_snapshot_route
+{
+    __u32 ip;
+    __u16 nh;
+    __u16 vlan;
+    __u8 depth;
+    __u8 reserved[3];
+};
+
+struct route_snapshot_route6
+{
+    __u8 ip[16];
+    __u16 nh;
+    __u16 vlan;
+    __u8 depth;
+    __u8 reserved[3];
+};
+
+struct route_snapshot
+{
+    void *map;
+    size_t size;
+
+    const struct route_snapshot_hdr *hdr;
+    const struct route_snapshot_nh *nhs;
+    const struct nh_group *groups;
+    const struct route_snapshot_route *routes;
+    const struct route_snapshot_route6 *routes6;
+};
+
+int routes_parse_line(char *line, int idx, struct route_entry *route);
+int routes_next_hop(struct next_hop *nhs, unsigned int *nb_nhs, unsigned int max, const struct rte_ether_addr *dmac, __u16 port);
+int routes_nh_value(struct next_hop *nhs, unsigned int *nb_nhs, struct nh_group *groups, unsigned int *nb_groups, const struct route_entry *route);
+int routes_snapshot_open(const char *file, struct route_snapshot *snap);
+void routes_snapshot_close(struct route_snapshot *snap);
+#endif
@@ -10,209 +10,1436 @@
 #include <errno.h>
 #include <signal.h>
 #include <pthread.h>
+#include <sys/stat.h>
 
 #include <dpdk_common.h>
 #include <rte_ip.h>
-#include <rte_hash.h>
+#include <rte_lpm.h>
+#include <rte_lpm6.h>
+#include <rte_malloc.h>
+#include <rte_rcu_qsbr.h>
+#include <rte_thread.h>
+#include <rte_version.h>
 #include <rte_jhash.h>
 
 #include <arpa/inet.h>
 
 #include "cmdline.h"
+#include "queues.h"
+#include "stats.h"
+#include "cksum.h"
+#include "routes.h"
+#include "bloom.h"
+#include "parse.h"
 
 /* Helpful defines */
 #ifndef htons
 #define htons(o) cpu_to_be16(o)
 #endif
 
-#define ETH_P_IP 0x0800
-#define ETH_P_8021Q	0x8100
 #define PROTOCOL_UDP 0x11
 
+// The LPM table uses a DIR-24-8 layout, so a lookup costs one memory read (two for prefixes longer than /24). Each VRF's tables are sized by the routes it holds, these are the upper limits.
+#define MAX_ROUTES 1048576
+#define NUMBER_TBL8S 65536
+
+// IPv6 prefixes are looked up in 8-bit strides after the first 24 bits, so they need a lot more groups.
+#define MAX_ROUTES6 262144
+#define NUMBER_TBL8S6 131072
+
+// The LPM tables reject empty rule and group tables.
+#define MIN_ROUTES 64
+#define MIN_TBL8S 16
+
 //#define DEBUG
 
-__u64 pckts_forwarded = 0;
-__u64 pckts_dropped = 0;
+// Each l-core caches recent IPv4 destinations in a direct-mapped table of 1024 entries (8 KB, so it stays within L1).
+#define ROUTE_CACHE_BITS 10
+#define ROUTE_CACHE_SIZE (1 << ROUTE_CACHE_BITS)
+#define ROUTE_CACHE_EMPTY 0xFFFE
+#define ROUTE_CACHE_NO_ROUTE 0xFFFF
+
+// Every VRF has its own LPM tables (each address family's table takes 64 MB for its first 24 bits alone, plus 1 KB per tbl8 group), so only VLANs with routes get one and only for the address families they have prefixes of.
+#define MAX_VRFS 16
+#define VRF_DONE 0xFF
+
+// How often the reload thread checks for a pending reload.
+#define RELOAD_CHECK_US 100000
+
+// A range of /24 blocks covered by an IPv4 prefix.
+struct bloom_range
+{
+    __u32 block;
+    __u32 nb;
+};
+
+// The amount of prefixes and (at most) tbl8 groups a VRF's LPM tables need to hold.
+struct vrf_size
+{
+    __u32 routes;
+    __u32 tbl8s;
+    __u32 routes6;
+    __u32 tbl8s6;
+};
+
+struct vrf
+{
+    // NULL if the VRF has no prefixes of the address family.
+    struct rte_lpm *lpm;
+    struct rte_lpm6 *lpm6;
+
+    // The LPM tables don't support /0 prefixes, so the default routes' next hops are stored separately (-1 if there's none).
+    __s32 default_nh;
+    __s32 default_nh6;
+
+    // Holds every /24 block covered by an IPv4 prefix, so destinations without a route are rejected with a single cache line read before the LPM lookup. This only works without a default route and is bypassed if the prefixes cover too many blocks.
+    struct bloom bloom;
+    unsigned int bloom_valid : 1;
+
+    // The /24 blocks covered by the IPv4 prefixes, collected while loading so the bloom filter is sized by how many blocks it'll hold (bloom_keys counts blocks covered by several prefixes more than once, which only makes it larger).
+    struct bloom_range *bloom_ranges;
+    unsigned int nb_bloom_ranges;
+    unsigned int max_bloom_ranges;
+    __u64 bloom_keys;
+};
+
+struct fib
+{
+    // Each VRF's LPM tables only store a 16-bit next hop index, the MAC addresses and egress port are stored in the next hop table. All VRFs and both address families share the next hop table, so changing one next hop affects all of its prefixes.
+    struct vrf vrfs[MAX_VRFS];
+    unsigned int nb_vrfs;
+
+    // The VRF index of each VLAN ID, so the VRF is picked with a single array read. Untagged packets and VLANs without routes of their own use the default VRF (0).
+    __u8 vlan_vrf[MAX_VLANS];
+
+    struct next_hop next_hops[MAX_NEXT_HOPS];
+    unsigned int nb_next_hops;
+
+    // ECMP routes store NH_GROUP_FLAG along with an index into the group table instead of a next hop index.
+    struct nh_group groups[MAX_NH_GROUPS];
+    unsigned int nb_groups;
+
+    __u32 generation;
+
+    // The size of each VLAN's VRF, only set while the routes are inserted.
+    const struct vrf_size *sizes;
+};
+
+struct route_cache_entry
+{
+    __u32 dst;
+    __u16 vrf;
+
+    // The resolved LPM value (after falling back to the default route), ROUTE_CACHE_NO_ROUTE or ROUTE_CACHE_EMPTY.
+    __u16 nh;
+};
+
+struct route_cache
+{
+    // The generation of the FIB the entries were resolved with, plus one (0 means the cache was never used).
+    __u32 generation;
+
+    struct route_cache_entry entries[ROUTE_CACHE_SIZE];
+};
+
+// The FIB currently used by the l-cores. This is only ever replaced as a whole and the old FIB is freed once all l-cores went through a quiescent state.
+struct fib *cur_fib = NULL;
+
+// Quiescent state based reclamation variable the l-cores report to after each loop iteration.
+struct rte_rcu_qsbr *fib_rcu = NULL;
+
+// Set by SIGHUP to request a routes file reload.
+volatile int reload = 0;
+
+struct cmdline cmd = {0};
+
+/**
+ * Creates the LPM tables of a VRF, sized by the routes its VLAN holds. Address families without prefixes don't get a table.
+ * 
+ * @param fib A pointer to the FIB.
+ * @param vrf A pointer to the VRF.
+ * @param vlan The VLAN ID (0 for the default VRF).
+ * 
+ * @return 0 on success or -1 on error.
+**/
+static int fib_vrf_tables(struct fib *fib, struct vrf *vrf, __u16 vlan)
+{
+    const struct vrf_size *sz = &fib->sizes[vlan];
+    char name[64];
+
+    // Create LPM table for route lookups.
+    if (sz->routes > 0)
+    {
+        snprintf(name, sizeof(name), "route_table_%u_%u", fib->generation, vlan);
+
+        struct rte_lpm_config lpmconf =
+        {
+            .max_rules = RTE_MIN(RTE_MAX(sz->routes, (__u32)MIN_ROUTES), (__u32)MAX_ROUTES),
+            .number_tbl8s = RTE_MIN(RTE_MAX(sz->tbl8s, (__u32)MIN_TBL8S), (__u32)NUMBER_TBL8S),
+            .flags = 0
+        };
+
+        vrf->lpm = rte_lpm_create(name, rte_socket_id(), &lpmconf);
+
+        if (vrf->lpm == NULL)
+        {
+            return -1;
+        }
+    }
+
+    // Create LPM table for IPv6 route lookups.
+    if (sz->routes6 > 0)
+    {
+        snprintf(name, sizeof(name), "route_table6_%u_%u", fib->generation, vlan);
+
+        struct rte_lpm6_config lpm6conf =
+        {
+            .max_rules = RTE_MIN(RTE_MAX(sz->routes6, (__u32)MIN_ROUTES), (__u32)MAX_ROUTES6),
+            .number_tbl8s = RTE_MIN(RTE_MAX(sz->tbl8s6, (__u32)MIN_TBL8S), (__u32)NUMBER_TBL8S6),
+            .flags = 0
+        };
+
+        vrf->lpm6 = rte_lpm6_create(name, rte_socket_id(), &lpm6conf);
+
+        if (vrf->lpm6 == NULL)
+        {
+            rte_lpm_free(vrf->lpm);
+            vrf->lpm = NULL;
+
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Retrieves the VRF of a VLAN, creating it along with its LPM tables if the VLAN doesn't have a VRF yet. This is only called while the routes are inserted (the default VRF's tables are created by fib_insert_routes()).
+ * 
+ * @param fib A pointer to the FIB.
+ * @param vlan The VLAN ID (0 for the default VRF).
+ * 
+ * @return A pointer to the VRF or NULL on error.
+**/
+static struct vrf *fib_vrf(struct fib *fib, __u16 vlan)
+{
+    // The default VRF always exists, so VLANs mapped to index 0 other than VLAN 0 don't have their own VRF yet.
+    if (vlan == 0 || fib->vlan_vrf[vlan] != 0)
+    {
+        return &fib->vrfs[fib->vlan_vrf[vlan]];
+    }
+
+    if (fib->nb_vrfs >= MAX_VRFS)
+    {
+        return NULL;
+    }
+
+    struct vrf *vrf = &fib->vrfs[fib->nb_vrfs];
+
+    vrf->default_nh = -1;
+    vrf->default_nh6 = -1;
+
+    if (fib_vrf_tables(fib, vrf, vlan) != 0)
+    {
+        return NULL;
+    }
+
+    fib->vlan_vrf[vlan] = (__u8)fib->nb_vrfs++;
+
+    return vrf;
+}
+
+/**
+ * Inserts a prefix into the LPM table of the matching VRF and address family.
+ * 
+ * @param fib A pointer to the FIB.
+ * @param vlan The VLAN ID whose VRF the prefix belongs to (0 for the default VRF).
+ * @param is_ipv6 Whether the prefix is an IPv6 prefix.
+ * @param ip The IPv4 address in host byte order.
+ * @param ip6 A pointer to the IPv6 address in network byte order.
+ * @param depth The prefix length.
+ * @param nh The next hop index (or NH_GROUP_FLAG with a group index).
+ * 
+ * @return 0 on success or negative error code.
+**/
+static int fib_add_route(struct fib *fib, __u16 vlan, int is_ipv6, __u32 ip, const __u8 *ip6, __u8 depth, __u32 nh)
+{
+    struct vrf *vrf = fib_vrf(fib, vlan);
+
+    if (vrf == NULL)
+    {
+        return -ENOSPC;
+    }
+
+    if (depth == 0)
+    {
+        if (is_ipv6)
+        {
+            vrf->default_nh6 = nh;
+        }
+        else
+        {
+            vrf->default_nh = nh;
+        }
+
+        return 0;
+    }
+
+    // The VRF's tables were sized without this prefix.
+    if ((is_ipv6 && vrf->lpm6 == NULL) || (!is_ipv6 && vrf->lpm == NULL))
+    {
+        return -ENOSPC;
+    }
+
+    if (is_ipv6)
+    {
+        return rte_lpm6_add(vrf->lpm6, ip6, depth, nh);
+    }
+
+    int ret = rte_lpm_add(vrf->lpm, ip, depth, nh);
+
+    if (ret != 0)
+    {
+        return ret;
+    }
+
+    // Remember the /24 blocks the prefix covers for the bloom filter.
+    __u32 nb_blocks = (depth >= 24) ? 1 : (1u << (24 - depth));
+
+    vrf->bloom_keys += nb_blocks;
+
+    // Once there are too many blocks for the bloom filter, there's nothing left to remember.
+    if (vrf->bloom_keys > BLOOM_MAX_KEYS)
+    {
+        free(vrf->bloom_ranges);
+
+        vrf->bloom_ranges = NULL;
+        vrf->nb_bloom_ranges = 0;
+        vrf->max_bloom_ranges = 0;
+
+        return 0;
+    }
+
+    if (vrf->nb_bloom_ranges >= vrf->max_bloom_ranges)
+    {
+        unsigned int max = (vrf->max_bloom_ranges > 0) ? vrf->max_bloom_ranges * 2 : 1024;
+        struct bloom_range *ranges = realloc(vrf->bloom_ranges, max * sizeof(*ranges));
+
+        // Without the blocks the bloom filter can't be built, so treat it like having too many.
+        if (ranges == NULL)
+        {
+            vrf->bloom_keys = BLOOM_MAX_KEYS + 1;
+
+            free(vrf->bloom_ranges);
+
+            vrf->bloom_ranges = NULL;
+            vrf->nb_bloom_ranges = 0;
+            vrf->max_bloom_ranges = 0;
+
+            return 0;
+        }
+
+        vrf->bloom_ranges = ranges;
+        vrf->max_bloom_ranges = max;
+    }
+
+    vrf->bloom_ranges[vrf->nb_bloom_ranges].block = (ip >> 8) & ~(nb_blocks - 1);
+    vrf->bloom_ranges[vrf->nb_bloom_ranges].nb = nb_blocks;
+    vrf->nb_bloom_ranges++;
+
+    return 0;
+}
+
+/**
+ * Builds the bloom filter of every VRF from the /24 blocks its IPv4 prefixes cover, sized by the amount of blocks. VRFs with a default route (where every destination is routable) or whose prefixes cover more blocks than BLOOM_MAX_KEYS bypass the bloom filter.
+ * 
+ * @param fib A pointer to the FIB.
+ * 
+ * @return Void
+**/
+static void fib_build_blooms(struct fib *fib)
+{
+    unsigned int i;
+
+    for (i = 0; i < fib->nb_vrfs; i++)
+    {
+        struct vrf *vrf = &fib->vrfs[i];
+
+        if (vrf->default_nh < 0 && bloom_create(&vrf->bloom, vrf->bloom_keys) == 0)
+        {
+            unsigned int r;
+
+            for (r = 0; r < vrf->nb_bloom_ranges; r++)
+            {
+                __u32 j;
+
+                for (j = 0; j < vrf->bloom_ranges[r].nb; j++)
+                {
+                    bloom_add(&vrf->bloom, vrf->bloom_ranges[r].block + j);
+                }
+            }
+
+            vrf->bloom_valid = 1;
+        }
+        else
+        {
+            printf("VRF #%u bypasses the bloom filter (%llu /24 blocks%s).\n", i, vrf->bloom_keys, (vrf->default_nh >= 0) ? ", default route" : "");
+        }
+
+        free(vrf->bloom_ranges);
+
+        vrf->bloom_ranges = NULL;
+        vrf->nb_bloom_ranges = 0;
+        vrf->max_bloom_ranges = 0;
+    }
+}
+
+/**
+ * Checks whether a value from a route snapshot points to an existing next hop or next hop group.
+ * 
+ * @param fib A pointer to the FIB.
+ * @param val The LPM value.
+ * 
+ * @return 1 if the value is valid or 0 otherwise.
+**/
+static int fib_value_valid(const struct fib *fib, __u32 val)
+{
+    if (val & NH_GROUP_FLAG)
+    {
+        return (val & ~NH_GROUP_FLAG) < fib->nb_groups;
+    }
+
+    return val < fib->nb_next_hops;
+}
+
+/**
+ * Inserts all prefixes into the LPM tables. The prefixes of each VLAN are counted first, so every VRF's LPM tables are sized by the routes it holds instead of the upper limits.
+ * 
+ * @param fib A pointer to the FIB (with its next hops and next hop groups already set).
+ * @param routes A pointer to the IPv4 prefixes.
+ * @param nb_routes The amount of IPv4 prefixes.
+ * @param routes6 A pointer to the IPv6 prefixes.
+ * @param nb_routes6 The amount of IPv6 prefixes.
+ * 
+ * @return The amount of routes added or -1 on error.
+**/
+static int fib_insert_routes(struct fib *fib, const struct route_snapshot_route *routes, __u32 nb_routes, const struct route_snapshot_route6 *routes6, __u32 nb_routes6)
+{
+    struct vrf_size *sizes = calloc(MAX_VLANS, sizeof(*sizes));
+    int added = 0;
+    __u32 i;
+
+    if (sizes == NULL)
+    {
+        return -1;
+    }
+
+    // Default routes aren't stored within the LPM tables. A prefix longer than /24 takes at most one tbl8 group in IPv4 and one per 8-bit stride past the first 24 bits in IPv6.
+    for (i = 0; i < nb_routes; i++)
+    {
+        if (routes[i].vlan < MAX_VLANS && routes[i].depth > 0)
+        {
+            sizes[routes[i].vlan].routes++;
+            sizes[routes[i].vlan].tbl8s += (routes[i].depth > 24);
+        }
+    }
+
+    for (i = 0; i < nb_routes6; i++)
+    {
+        if (routes6[i].vlan < MAX_VLANS && routes6[i].depth > 0)
+        {
+            sizes[routes6[i].vlan].routes6++;
+            sizes[routes6[i].vlan].tbl8s6 += (routes6[i].depth > 24) ? (routes6[i].depth - 24 + 7) / 8 : 0;
+        }
+    }
+
+    fib->sizes = sizes;
+
+    // The default VRF exists before its size is known, so its tables are created now.
+    if (fib_vrf_tables(fib, &fib->vrfs[0], 0) != 0)
+    {
+        fib->sizes = NULL;
+        free(sizes);
+
+        return -1;
+    }
+
+    for (i = 0; i < nb_routes; i++)
+    {
+        const struct route_snapshot_route *r = &routes[i];
+
+        if (!fib_value_valid(fib, r->nh) || r->vlan >= MAX_VLANS)
+        {
+            continue;
+        }
+
+        int ret = fib_add_route(fib, r->vlan, 0, r->ip, NULL, r->depth, r->nh);
+
+        if (ret == 0)
+        {
+            added++;
+        }
+        else
+        {
+            printf("WARNING - IPv4 route #%u failed due to LPM insert fail (%d).\n", i + 1, ret);
+        }
+    }
+
+    for (i = 0; i < nb_routes6; i++)
+    {
+        const struct route_snapshot_route6 *r = &routes6[i];
+
+        if (!fib_value_valid(fib, r->nh) || r->vlan >= MAX_VLANS)
+        {
+            continue;
+        }
+
+        int ret = fib_add_route(fib, r->vlan, 1, 0, r->ip, r->depth, r->nh);
+
+        if (ret == 0)
+        {
+            added++;
+        }
+        else
+        {
+            printf("WARNING - IPv6 route #%u failed due to LPM insert fail (%d).\n", i + 1, ret);
+        }
+    }
+
+    fib->sizes = NULL;
+    free(sizes);
+
+    return added;
+}
+
+/**
+ * Makes room for one more element within a growable array.
+ * 
+ * @param arr A pointer to the array's pointer.
+ * @param nb The amount of elements within the array.
+ * @param max A pointer to the amount of elements the array has room for.
+ * @param size The size of an element.
+ * 
+ * @return 0 on success or -1 if the array couldn't be grown (in which case it's left as is).
+**/
+static int grow_array(void **arr, unsigned int nb, unsigned int *max, size_t size)
+{
+    if (nb < *max)
+    {
+        return 0;
+    }
+
+    unsigned int nmax = (*max > 0) ? *max * 2 : 1024;
+    void *narr = realloc(*arr, (size_t)nmax * size);
+
+    if (narr == NULL)
+    {
+        return -1;
+    }
+
+    *arr = narr;
+    *max = nmax;
+
+    return 0;
+}
+
+/**
+ * Reads a file in "<ip>[/<cidr>] <mac address>[@<port>][,...] [egress port] [vlan=<id>]" format and inserts into the routing table. The IP may either be an IPv4 or IPv6 address. The prefixes are collected first (like the ones of a route snapshot), so the LPM tables are sized by them.
+ * 
+ * @param file Path to file to open and scan.
+ * @param fib A pointer to the FIB to insert into.
+ * 
+ * @return The amount of routes added or -1 on error.
+**/
+static int scan_route_table_and_add(const char *file, struct fib *fib)
+{
+    struct route_snapshot_route *routes = NULL;
+    struct route_snapshot_route6 *routes6 = NULL;
+    unsigned int nb_routes = 0;
+    unsigned int nb_routes6 = 0;
+    unsigned int max_routes = 0;
+    unsigned int max_routes6 = 0;
+    int i = 0;
+
+    FILE *fp = fopen(file, "r");
+
+    if (!fp)
+    {
+        return -1;
+    }
+
+    // Variables needed for looping through each line.
+    char *line = NULL;
+    size_t len = 0;
+
+    // Go through each line.
+    while (getline(&line, &len, fp) != -1)
+    {
+        struct route_entry route;
+
+        // Increment I so we have an index.
+        i++;
+
+        // Parse the line, this prints a warning itself on failure.
+        if (routes_parse_line(line, i, &route) < 1)
+        {
+            continue;
+        }
+
+        // Retrieve the next hop (or next hop group) the prefix will point to.
+        int nh = routes_nh_value(fib->next_hops, &fib->nb_next_hops, fib->groups, &fib->nb_groups, &route);
+
+        if (nh < 0)
+        {
+            printf("WARNING - Route #%d failed due to next hop or group table being full (%d/%d max).\n", i, MAX_NEXT_HOPS, MAX_NH_GROUPS);
+
+            continue;
+        }
+
+#ifdef DEBUG
+        printf("Parsed route #%d/%u => " RTE_ETHER_ADDR_PRT_FMT " (%u paths, value %d).\n", i, route.depth, RTE_ETHER_ADDR_BYTES(&route.paths[0].dmac), route.nb_paths, nh);
+#endif
+
+        if (route.is_ipv6)
+        {
+            if (grow_array((void **)&routes6, nb_routes6, &max_routes6, sizeof(*routes6)) != 0)
+            {
+                printf("WARNING - Route #%d failed due to running out of memory.\n", i);
+
+                continue;
+            }
+
+            struct route_snapshot_route6 *r = &routes6[nb_routes6++];
+
+            memset(r, 0, sizeof(*r));
+            memcpy(r->ip, route.ip6, sizeof(r->ip));
+            r->nh = (__u16)nh;
+            r->vlan = route.vlan;
+            r->depth = route.depth;
+        }
+        else
+        {
+            if (grow_array((void **)&routes, nb_routes, &max_routes, sizeof(*routes)) != 0)
+            {
+                printf("WARNING - Route #%d failed due to running out of memory.\n", i);
+
+                continue;
+            }
+
+            struct route_snapshot_route *r = &routes[nb_routes++];
+
+            memset(r, 0, sizeof(*r));
+            r->ip = route.ip;
+            r->nh = (__u16)nh;
+            r->vlan = route.vlan;
+            r->depth = route.depth;
+        }
+    }
+
+    // Free the line buffer and close the file.
+    free(line);
+    fclose(fp);
+
+    // Now insert into the LPM tables.
+    int routes_added = fib_insert_routes(fib, routes, nb_routes, routes6, nb_routes6);
+
+    free(routes);
+    free(routes6);
+
+    return routes_added;
+}
+
+/**
+ * Bulk loads the routing table from a binary snapshot created by route_compile. The snapshot is memory mapped and its next hops and prefixes are inserted as is, so no text parsing or next hop lookups are needed.
+ * 
+ * @param file Path to the snapshot file.
+ * @param fib A pointer to the FIB to insert into (please ensure to check the FIB and its LPM table pointers before passing).
+ * 
+ * @return The amount of routes added or -1 on error.
+**/
+static int load_route_snapshot(const char *file, struct fib *fib)
+{
+    struct route_snapshot snap;
+    int routes = 0;
+    __u32 i;
+
+    if (routes_snapshot_open(file, &snap) != 0)
+    {
+        return -1;
+    }
+
+    if (snap.hdr->nb_next_hops > MAX_NEXT_HOPS || snap.hdr->nb_groups > MAX_NH_GROUPS)
+    {
+        routes_snapshot_close(&snap);
+
+        return -1;
+    }
+
+    // Copy the next hops.
+    for (i = 0; i < snap.hdr->nb_next_hops; i++)
+    {
+        memset(&fib->next_hops[i], 0, sizeof(fib->next_hops[i]));
+
+        rte_ether_addr_copy(&snap.nhs[i].dmac, &fib->next_hops[i].dmac);
+        fib->next_hops[i].port = snap.nhs[i].port;
+    }
+
+    fib->nb_next_hops = snap.hdr->nb_next_hops;
+
+    // Copy the next hop groups, making sure each one only references existing next hops.
+    for (i = 0; i < snap.hdr->nb_groups; i++)
+    {
+        const struct nh_group *grp = &snap.groups[i];
+        __u16 j;
+
+        if (grp->nb == 0 || grp->nb > MAX_ECMP_PATHS)
+        {
+            routes_snapshot_close(&snap);
+
+            return -1;
+        }
+
+        for (j = 0; j < grp->nb; j++)
+        {
+            if (grp->nhs[j] >= fib->nb_next_hops)
+            {
+                routes_snapshot_close(&snap);
+
+                return -1;
+            }
+        }
+
+        fib->groups[i] = *grp;
+    }
+
+    fib->nb_groups = snap.hdr->nb_groups;
+
+    // Insert the prefixes (they're sorted by prefix length, so each insert only touches its own range).
+    routes = fib_insert_routes(fib, snap.routes, snap.hdr->nb_routes, snap.routes6, snap.hdr->nb_routes6);
+
+    routes_snapshot_close(&snap);
+
+    return routes;
+}
+
+/**
+ * Resolves the source MAC address of each next hop from its egress port. Next hops with an egress port that isn't enabled go out the paired port instead.
+ * 
+ * @param fib A pointer to the FIB.
+ * 
+ * @return Void
+**/
+static void fib_resolve_next_hops(struct fib *fib)
+{
+    unsigned int i;
+
+    for (i = 0; i < fib->nb_next_hops; i++)
+    {
+        struct next_hop *nh = &fib->next_hops[i];
+
+        if (nh->port == NH_PORT_PAIRED)
+        {
+            continue;
+        }
+
+        // Ports past the port mask's width (or that don't exist) can't be enabled, so don't shift by them or look them up.
+        if (nh->port >= sizeof(enabled_port_mask) * 8 || !rte_eth_dev_is_valid_port(nh->port) || (enabled_port_mask & (1ULL << nh->port)) == 0)
+        {
+            printf("WARNING - Next hop #%u egress port %u isn't enabled, using the paired port instead.\n", i, nh->port);
+
+            nh->port = NH_PORT_PAIRED;
+
+            continue;
+        }
+
+        rte_ether_addr_copy(&ports[nh->port].mac, &nh->smac);
+    }
+}
+
+/**
+ * Checks whether a route snapshot exists and isn't older than the routes file.
+ * 
+ * @param file Path to the routes file.
+ * @param snapshot Path to the snapshot file.
+ * 
+ * @return 1 if the snapshot should be used or 0 otherwise.
+**/
+static int snapshot_is_current(const char *file, const char *snapshot)
+{
+    struct stat fst;
+    struct stat sst;
+
+    if (stat(snapshot, &sst) != 0)
+    {
+        return 0;
+    }
+
+    // If there's no routes file, the snapshot is all we have.
+    if (stat(file, &fst) != 0)
+    {
+        return 1;
+    }
+
+    if (fst.st_mtime > sst.st_mtime)
+    {
+        printf("WARNING - Route snapshot %s is older than %s, ignoring it (run route_compile to update it).\n", snapshot, file);
+
+        return 0;
+    }
+
+    return 1;
+}
+
+/**
+ * Frees a FIB along with the LPM tables of its VRFs.
+ * 
+ * @param fib A pointer to the FIB.
+ * 
+ * @return Void
+**/
+static void fib_free(struct fib *fib)
+{
+    unsigned int i;
+
+    if (fib == NULL)
+    {
+        return;
+    }
+
+    for (i = 0; i < fib->nb_vrfs; i++)
+    {
+        rte_lpm_free(fib->vrfs[i].lpm);
+        rte_lpm6_free(fib->vrfs[i].lpm6);
+
+        bloom_free(&fib->vrfs[i].bloom);
+        free(fib->vrfs[i].bloom_ranges);
+    }
+
+    rte_free(fib);
+}
+
+/**
+ * Creates a new FIB and fills it from the routes file. This is done off the datapath, so the l-cores keep forwarding with the current FIB in the meantime.
+ * 
+ * @param file Path to the routes file.
+ * @param snapshot Path to the binary route snapshot, which is preferred over the routes file if it's current.
+ * @param generation The FIB generation (used to give each LPM table a unique name).
+ * @param allow_empty Whether to return an empty FIB if neither the snapshot nor the routes file could be read (only done on startup, reloads keep the current routes instead).
+ * 
+ * @return A pointer to the new FIB or NULL on error.
+**/
+static struct fib *fib_create(const char *file, const char *snapshot, __u32 generation, int allow_empty)
+{
+    struct fib *fib = rte_zmalloc("fib", sizeof(struct fib), RTE_CACHE_LINE_SIZE);
+
+    if (fib == NULL)
+    {
+        return NULL;
+    }
+
+    fib->generation = generation;
+
+    // Setup the default VRF, which is used by untagged packets and VLANs without routes of their own. Its LPM tables are created once the routes are counted.
+    fib->vrfs[0].default_nh = -1;
+    fib->vrfs[0].default_nh6 = -1;
+    fib->nb_vrfs = 1;
+
+    int routes = -1;
+
+    // Bulk load the snapshot if we have a current one.
+    if (snapshot_is_current(file, snapshot))
+    {
+        routes = load_route_snapshot(snapshot, fib);
+
+        if (routes < 0)
+        {
+            printf("WARNING - Failed to load route snapshot => %s, falling back to %s.\n", snapshot, file);
+
+            // Drop whatever next hops the snapshot got to copy.
+            fib->nb_next_hops = 0;
+            fib->nb_groups = 0;
+        }
+    }
+
+    // Otherwise, scan the route table and insert into the LPM table.
+    if (routes < 0)
+    {
+        routes = scan_route_table_and_add(file, fib);
+    }
+
+    if (routes < 0)
+    {
+        printf("WARNING - Did not add any routes due to error opening routes file => %s.\n", file);
+
+        if (!allow_empty)
+        {
+            fib_free(fib);
+
+            return NULL;
+        }
+    }
+    else
+    {
+        fib_resolve_next_hops(fib);
+
+        fib_build_blooms(fib);
+
+        printf("Added %u routes to table (%u VRFs, %u next hops, %u next hop groups, generation %u)!\n", routes, fib->nb_vrfs, fib->nb_next_hops, fib->nb_groups, generation);
+    }
+
+    return fib;
+}
+
+/**
+ * Retrieves the flow hash of an IPv4 packet. The NIC's RSS hash is used if it provided one, otherwise the 5-tuple is hashed in software. Fragments only hash the addresses and protocol, since only the first fragment holds the ports.
+ * 
+ * @param pckt A pointer to the rte_mbuf container the packet data.
+ * @param iph A pointer to the packet's IPv4 header.
+ * 
+ * @return The flow hash.
+**/
+static inline __u32 flow_hash_ipv4(const struct rte_mbuf *pckt, const struct rte_ipv4_hdr *iph)
+{
+    if (pckt->ol_flags & RTE_MBUF_F_RX_RSS_HASH)
+    {
+        return pckt->hash.rss;
+    }
+
+    __u32 l4 = 0;
+
+    if ((iph->next_proto_id == IPPROTO_TCP || iph->next_proto_id == IPPROTO_UDP) && (iph->fragment_offset & htons(RTE_IPV4_HDR_MF_FLAG | RTE_IPV4_HDR_OFFSET_MASK)) == 0)
+    {
+        // The source and destination ports are the first four bytes of both the TCP and UDP header.
+        memcpy(&l4, (const __u8 *)iph + ((iph->version_ihl & RTE_IPV4_HDR_IHL_MASK) << 2), sizeof(l4));
+    }
+
+    return rte_jhash_3words(iph->src_addr, iph->dst_addr, l4, iph->next_proto_id);
+}
+
+/**
+ * Retrieves the flow hash of an IPv6 packet. The NIC's RSS hash is used if it provided one, otherwise the 5-tuple is hashed in software (packets with extension headers only hash the addresses and next header).
+ * 
+ * @param pckt A pointer to the rte_mbuf container the packet data.
+ * @param ip6h A pointer to the packet's IPv6 header.
+ * 
+ * @return The flow hash.
+**/
+static inline __u32 flow_hash_ipv6(const struct rte_mbuf *pckt, const struct rte_ipv6_hdr *ip6h)
+{
+    if (pckt->ol_flags & RTE_MBUF_F_RX_RSS_HASH)
+    {
+        return pckt->hash.rss;
+    }
+
+    __u32 l4 = 0;
+
+    if (ip6h->proto == IPPROTO_TCP || ip6h->proto == IPPROTO_UDP)
+    {
+        memcpy(&l4, ip6h + 1, sizeof(l4));
+    }
+
+    // The source and destination addresses are adjacent, so hash both at once.
+    return rte_jhash(&ip6h->src_addr, 32, l4 ^ ip6h->proto);
+}
+
+/**
+ * Retrieves the next hop an LPM value points to. For ECMP routes, the flow hash picks one of the group's next hops so all packets of a flow take the same path.
+ * 
+ * @param fib A pointer to the FIB.
+ * @param val The LPM value (a next hop index or NH_GROUP_FLAG with a group index).
+ * @param hash The flow hash (only used for ECMP routes).
+ * 
+ * @return A pointer to the next hop.
+**/
+static inline const struct next_hop *fib_next_hop(const struct fib *fib, __u32 val, __u32 hash)
+{
+    if (likely(!(val & NH_GROUP_FLAG)))
+    {
+        return &fib->next_hops[val];
+    }
+
+    const struct nh_group *grp = &fib->groups[val & ~NH_GROUP_FLAG];
+
+    // Scale the hash into the group with a multiply instead of a modulo. This uses the hash's upper bits, while the NIC's redirection table uses its lower bits to pick the RX queue, so each l-core still spreads its flows over all paths.
+    return &fib->next_hops[grp->nhs[((__u64)hash * grp->nb) >> 32]];
+}
 
 /**
- * Reads a file in "<ip> <mac address>" format and inserts into the routing table.
+ * Empties an l-core's route cache and ties it to a FIB generation.
  * 
- * @param file Path to file to open and scan.
- * @param route_tbl A pointer to the route hash table (please ensure to check the table pointer before passing).
+ * @param cache A pointer to the route cache.
+ * @param generation The FIB generation.
  * 
- * @return The amount of routes added or -1 on error.
+ * @return Void
 **/
-static int scan_route_table_and_add(const char *file, struct rte_hash *route_tbl)
+static void route_cache_reset(struct route_cache *cache, __u32 generation)
 {
-    // This represents the amount of routes we've added.
-    int routes = 0;
-    int i = 0;
-
-    FILE *fp = fopen(file, "r");
+    unsigned i;
 
-    if (!fp)
+    for (i = 0; i < ROUTE_CACHE_SIZE; i++)
     {
-        return -1;
+        cache->entries[i].dst = 0;
+        cache->entries[i].vrf = 0;
+        cache->entries[i].nh = ROUTE_CACHE_EMPTY;
     }
 
-    // Variables needed for looping through each line.
-    char *line = NULL;
-    ssize_t len;
+    cache->generation = generation + 1;
+}
 
-    // Go through each line.
-    while (getline(&line, &len, fp) != -1)
+/**
+ * Retrieves the route cache slot of an IPv4 destination within a VRF.
+ * 
+ * @param cache A pointer to the route cache.
+ * @param dst The destination IP in host byte order.
+ * @param vrf The VRF index.
+ * 
+ * @return A pointer to the cache entry.
+**/
+static inline struct route_cache_entry *route_cache_slot(struct route_cache *cache, __u32 dst, __u8 vrf)
+{
+    // Fibonacci hashing spreads neighbouring addresses over the whole table.
+    return &cache->entries[((dst ^ ((__u32)vrf << 24)) * 2654435761u) >> (32 - ROUTE_CACHE_BITS)];
+}
+
+/**
+ * Performs bulk LPM lookups on the IPv4 tables of the VRFs the destinations belong to. The destinations of each VRF are gathered and looked up at once (bursts usually belong to a single VRF, so this is one lookup).
+ * 
+ * @param fib A pointer to the FIB.
+ * @param vrfs A pointer to the VRF index of each destination (this is modified).
+ * @param ips A pointer to the destination IPs in host byte order.
+ * @param nhs A pointer to the array to store the resolved LPM values in (-1 if there's no route).
+ * @param nb The amount of destinations.
+ * 
+ * @return Void
+**/
+static void fib_lookup_bulk(const struct fib *fib, __u8 *vrfs, const __u32 *ips, __s32 *nhs, unsigned nb)
+{
+    __u32 keys[nb];
+    __u32 res[nb];
+    unsigned idx[nb];
+    unsigned i;
+    unsigned j;
+
+    for (i = 0; i < nb; i++)
     {
-        char ip[64];
-        char dmac[64];
+        // Already looked up along with an earlier destination of the same VRF.
+        if (vrfs[i] == VRF_DONE)
+        {
+            continue;
+        }
 
-        // Increment I so we have an index.
-        i++;
+        const __u8 v = vrfs[i];
+        const struct vrf *vrf = &fib->vrfs[v];
+        unsigned n = 0;
 
-        // Represents the part of the data we've split.
-        char *ptr = NULL;
+        for (j = i; j < nb; j++)
+        {
+            if (vrfs[j] == v)
+            {
+                keys[n] = ips[j];
+                idx[n++] = j;
 
-        ptr = strtok(line, " ");
+                vrfs[j] = VRF_DONE;
+            }
+        }
 
-        // Check to see if we found a match.
-        if (ptr == NULL)
+        // VRFs without IPv4 prefixes only have their default route.
+        if (vrf->lpm == NULL)
         {
-            printf("WARNING - Route #%d failed due to trying to pick IP address.\n", i);
+            for (j = 0; j < n; j++)
+            {
+                nhs[idx[j]] = vrf->default_nh;
+            }
+
             continue;
         }
 
-        // Copy the first part to IP.
-        strcpy(ip, ptr);
+        rte_lpm_lookup_bulk(vrf->lpm, keys, res, n);
 
-        // Move onto the next.
-        ptr = strtok(NULL, " ");
-
-        // Check.
-        if (ptr == NULL)
+        for (j = 0; j < n; j++)
         {
-            printf("WARNING - Route #%d failed due to trying to pick MAC address.\n", i);
+            nhs[idx[j]] = (res[j] & RTE_LPM_LOOKUP_SUCCESS) ? (__s32)(res[j] & ~RTE_LPM_LOOKUP_SUCCESS) : vrf->default_nh;
+        }
+    }
+}
+
+/**
+ * Same as fib_lookup_bulk() for IPv6 destinations.
+ * 
+ * @param fib A pointer to the FIB.
+ * @param vrfs A pointer to the VRF index of each destination (this is modified).
+ * @param ips A pointer to the destination IPs in network byte order.
+ * @param nhs A pointer to the array to store the resolved LPM values in (-1 if there's no route).
+ * @param nb The amount of destinations.
+ * 
+ * @return Void
+**/
+static void fib_lookup6_bulk(const struct fib *fib, __u8 *vrfs, __u8 (*ips)[16], __s32 *nhs, unsigned nb)
+{
+    __u8 keys[nb][16];
+    __s32 res[nb];
+    unsigned idx[nb];
+    unsigned i;
+    unsigned j;
 
+    for (i = 0; i < nb; i++)
+    {
+        if (vrfs[i] == VRF_DONE)
+        {
             continue;
         }
 
-        // Copy MAC address.
-        strcpy(dmac, ptr);
+        const __u8 v = vrfs[i];
+        const struct vrf *vrf = &fib->vrfs[v];
+        unsigned n = 0;
+
+        for (j = i; j < nb; j++)
+        {
+            if (vrfs[j] == v)
+            {
+                memcpy(keys[n], ips[j], sizeof(keys[n]));
+                idx[n++] = j;
 
-        // Convert IP address to unsigned 32-bit integer in host network byte order.
-        struct in_addr ipaddr;
+                vrfs[j] = VRF_DONE;
+            }
+        }
 
-        // If inet_aton() returns 0, it failed.
-        if (inet_aton(ip, &ipaddr) == 0)
+        if (vrf->lpm6 == NULL)
         {
-            printf("WARNING - Route #%d failed due to IP address not parsing properly (%s).\n", i, ip);
+            for (j = 0; j < n; j++)
+            {
+                nhs[idx[j]] = vrf->default_nh6;
+            }
 
             continue;
         }
 
-        // Now convert MAC address.
-        struct rte_ether_addr dmacval[6];
+        // Misses are returned as -1.
+        rte_lpm6_lookup_bulk_func(vrf->lpm6, keys, res, n);
+
+        for (j = 0; j < n; j++)
+        {
+            nhs[idx[j]] = (res[j] >= 0) ? res[j] : vrf->default_nh6;
+        }
+    }
+}
+
+/**
+ * Rewrites the ethernet header of a routed packet for its next hop.
+ * 
+ * @param eth A pointer to the packet's ethernet header.
+ * @param port_id The port ID the packet came from.
+ * @param nh A pointer to the next hop from the route lookup.
+ * 
+ * @return The egress port.
+**/
+static inline __u16 fwd_to_next_hop(struct rte_ether_hdr *eth, unsigned port_id, const struct next_hop *nh)
+{
+    __u16 dst_port;
+
+    if (likely(nh->port != NH_PORT_PAIRED))
+    {
+        // The next hop holds the complete address rewrite, so copy the destination and source MAC addresses at once.
+        dst_port = nh->port;
+
+        memcpy(eth, nh, 2 * sizeof(struct rte_ether_addr));
+    }
+    else
+    {
+        // Otherwise, copy the port we're going out from as the source MAC and the correct destination from the route lookup.
+        dst_port = ports[port_id].tx_port;
 
-        sscanf(dmac, "%hhx:%hhx:%hhx:%hhx:%hhx:%hhx", &dmacval->addr_bytes[0], &dmacval->addr_bytes[1], &dmacval->addr_bytes[2], &dmacval->addr_bytes[3], &dmacval->addr_bytes[4], &dmacval->addr_bytes[5]);
+        rte_ether_addr_copy(&nh->dmac, &eth->dst_addr);
+        rte_ether_addr_copy(&ports[dst_port].mac, &eth->src_addr);
+    }
 
 #ifdef DEBUG
-        printf("Inserting into route table %s (%u) => %hhx:%hhx:%hhx:%hhx:%hhx:%hhx.\n", ip, (__u32)ipaddr.s_addr, dmacval->addr_bytes[0], dmacval->addr_bytes[1], dmacval->addr_bytes[2], dmacval->addr_bytes[3], dmacval->addr_bytes[4], dmacval->addr_bytes[5]);
+    printf("Packet forwarding from " RTE_ETHER_ADDR_PRT_FMT " => " RTE_ETHER_ADDR_PRT_FMT ".\n", RTE_ETHER_ADDR_BYTES(&eth->src_addr), RTE_ETHER_ADDR_BYTES(&eth->dst_addr));
 #endif
 
-        // Now insert into the map, check, and increment routes if successful.
-        int ret = rte_hash_add_key_data(route_tbl, &ipaddr, &dmacval);
+    return dst_port;
+}
 
-        if (ret == 0)
+/**
+ * Transmits the routed packets of a burst, grouped by their egress port. Packets of each group keep their order, so flows aren't reordered.
+ * 
+ * @param out A pointer to the array of routed packets.
+ * @param out_ports A pointer to the array of egress ports.
+ * @param nb_out The amount of routed packets.
+ * @param qconf A pointer to the l-core's queue config (for the TX queue and buffers).
+ * @param st A pointer to the l-core's stats block.
+ * 
+ * @return Void
+**/
+static inline void tx_by_port(struct rte_mbuf **out, __u16 *out_ports, unsigned nb_out, struct lcore_queue_conf *qconf, struct lcore_stats *st)
+{
+    struct rte_mbuf *grp[nb_out];
+    unsigned i;
+    unsigned j;
+
+    // Increment packets TX count before handing them over (packets the TX queue has no room for are moved to the drops).
+    stats_fwd_bulk(st, nb_out);
+
+    for (i = 0; i < nb_out; i++)
+    {
+        // Already sent with an earlier group.
+        if (out[i] == NULL)
         {
-            routes++;
+            continue;
         }
-        else
+
+        __u16 dst_port = out_ports[i];
+        __u16 nb_grp = 0;
+
+        // Bursts usually go out a handful of ports, so collecting each port's packets with a scan is cheap.
+        for (j = i; j < nb_out; j++)
         {
-            printf("WARNING - Route #%d failed due to map insert fail.\n", i);
+            if (out[j] != NULL && out_ports[j] == dst_port)
+            {
+                grp[nb_grp++] = out[j];
+                out[j] = NULL;
+            }
         }
+
+        queues_tx_burst(qconf, dst_port, grp, nb_grp);
     }
+}
 
-    // Close the file.
-    fclose(fp);
+/**
+ * Drops a packet that has no route.
+ * 
+ * @param pckt A pointer to the rte_mbuf container the packet data.
+ * @param st A pointer to the l-core's stats block.
+ * 
+ * @return Void
+**/
+static inline void drop_no_route(struct rte_mbuf *pckt, struct lcore_stats *st)
+{
+    // Increment dropped packet counter.
+    stats_drop(st, DROP_NO_ROUTE);
 
-    return routes;
+    // Free the packet's mbuf.
+    rte_pktmbuf_free(pckt);
 }
 
 /**
- * Does lookup on hash map and forwards if need to be (otherwise drops).
+ * Does longest prefix match lookups on the route tables for an entire RX burst and forwards the packets that need to be (otherwise drops). IPv4 and IPv6 packets within the same burst are each resolved with one bulk lookup per VRF.
  * 
- * @param pckt A pointer to the rte_mbuf container the packet data.
+ * @param pckts A pointer to the array of rte_mbuf containers from the RX burst.
+ * @param meta A pointer to the parsed metadata of the burst.
  * @param portid The port ID we're inspecting from.
- * @param route_tbl A pointer to the route hash table (struct rte_hash).
+ * @param qconf A pointer to the l-core's queue config (for the TX queue and buffers).
+ * @param st A pointer to the l-core's stats block.
+ * @param cache A pointer to the l-core's route cache.
+ * @param fib A pointer to the FIB (struct fib).
  * 
  * @return Void
 **/
-static void fwd_pckt(struct rte_mbuf *pckt, unsigned port_id, struct rte_hash *route_tbl)
+static void fwd_burst(struct rte_mbuf **pckts, const struct parse_meta *meta, unsigned port_id, struct lcore_queue_conf *qconf, struct lcore_stats *st, struct route_cache *cache, const struct fib *fib)
 {
-    // Data points to the start of packet data within the mbuf.
-    void *data = pckt->buf_addr + pckt->data_off;
+    const unsigned nb_rx = meta->nb;
+
+    // IPv4 packets that are routable candidates along with their ethernet and IPv4 headers and destination IPs (host byte order).
+    struct rte_mbuf *fwd[nb_rx];
+    struct rte_ether_hdr *eths[nb_rx];
+    struct rte_ipv4_hdr *iphs[nb_rx];
+    __s32 nhs[nb_rx];
+
+    // IPv4 destinations that missed the route cache (host byte order) along with their VRF and the packet each one belongs to.
+    __u32 miss_ips[nb_rx];
+    __u8 miss_vrfs[nb_rx];
+    __s32 miss_nhs[nb_rx];
+    unsigned miss_idx[nb_rx];
+    unsigned nb_miss = 0;
+
+    // The same for IPv6 packets (destination IPs are in network byte order).
+    struct rte_mbuf *fwd6[nb_rx];
+    struct rte_ether_hdr *eths6[nb_rx];
+    struct rte_ipv6_hdr *ip6hs[nb_rx];
+    __u8 dst_ips6[nb_rx][16];
+    __u8 vrfs6[nb_rx];
+    __s32 nhs6[nb_rx];
+
+    // Routed packets of both address families along with their egress ports.
+    struct rte_mbuf *out[nb_rx];
+    __u16 out_ports[nb_rx];
+    unsigned nb_out = 0;
+
+    unsigned nb_fwd = 0;
+    unsigned nb_fwd6 = 0;
+    unsigned i;
+
+    // The cache is emptied whenever the FIB is replaced, so it never returns a next hop of an older FIB.
+    if (unlikely(cache->generation != fib->generation + 1))
+    {
+        route_cache_reset(cache, fib->generation);
+    }
 
-    // The offset.
-    unsigned int offset = 0;
+    // First pass parses every packet within the burst and collects the destination IPs.
+    for (i = 0; i < nb_rx; i++)
+    {
+        struct rte_mbuf *pckt = pckts[i];
 
-    // Initialize ethernet header.
-    struct rte_ether_hdr *eth = data;
+        // Data points to the start of packet data within the mbuf.
+        void *data = pckt->buf_addr + pckt->data_off;
 
-    offset += sizeof(struct rte_ether_hdr);
+        // Initialize ethernet header.
+        struct rte_ether_hdr *eth = data;
 
-    // Make sure we're dealing with IPv4 or a VLAN.
-    if (eth->ether_type != htons(ETH_P_IP) && eth->ether_type != htons(ETH_P_8021Q))
-    {
-        rte_pktmbuf_free(pckt);
+        // The outermost VLAN ID selects the VRF with a single array read (untagged packets use the default VRF).
+        __u8 vrf_idx = fib->vlan_vrf[meta->vlan[i]];
 
-        return;
+        if (meta->l3[i] == PARSE_L3_IPV4)
+        {
+            // Initialize IPv4 header.
+            struct rte_ipv4_hdr *iph = data + meta->l3_off[i];
+
+            // Drop packets whose TTL would expire here.
+            if (iph->time_to_live <= 1)
+            {
+                rte_pktmbuf_free(pckt);
+
+                stats_drop(st, DROP_TTL);
+
+                continue;
+            }
+
+            // LPM keys are in host byte order.
+            __u32 dst = rte_be_to_cpu_32(meta->dst_ip[i]);
+            struct route_cache_entry *ce = route_cache_slot(cache, dst, vrf_idx);
+            const struct vrf *vrf = &fib->vrfs[vrf_idx];
+
+            fwd[nb_fwd] = pckt;
+            eths[nb_fwd] = eth;
+            iphs[nb_fwd] = iph;
+
+            // Only destinations missing from the cache go through the LPM lookup.
+            if (likely(ce->dst == dst && ce->vrf == vrf_idx && ce->nh != ROUTE_CACHE_EMPTY))
+            {
+                nhs[nb_fwd] = (ce->nh == ROUTE_CACHE_NO_ROUTE) ? -1 : ce->nh;
+            }
+            else if (vrf->bloom_valid && vrf->default_nh < 0 && !bloom_test(&vrf->bloom, dst >> 8))
+            {
+                // No prefix covers the destination (the bloom filter can only reject destinations if there's no default route to fall back to), so drop it right away without a lookup or polluting the cache (e.g. scans and spoofed destinations).
+                drop_no_route(pckt, st);
+
+                continue;
+            }
+            else
+            {
+                miss_ips[nb_miss] = dst;
+                miss_vrfs[nb_miss] = vrf_idx;
+                miss_idx[nb_miss] = nb_fwd;
+                nb_miss++;
+            }
+
+            nb_fwd++;
+        }
+        else if (meta->l3[i] == PARSE_L3_IPV6)
+        {
+            // Initialize IPv6 header.
+            struct rte_ipv6_hdr *ip6h = data + meta->l3_off[i];
+
+            // Drop packets whose hop limit would expire here, otherwise decrement it (IPv6 has no header checksum).
+            if (ip6h->hop_limits <= 1)
+            {
+                rte_pktmbuf_free(pckt);
+
+                stats_drop(st, DROP_TTL);
+
+                continue;
+            }
+
+            ip6h->hop_limits--;
+
+            fwd6[nb_fwd6] = pckt;
+            eths6[nb_fwd6] = eth;
+            ip6hs[nb_fwd6] = ip6h;
+            memcpy(dst_ips6[nb_fwd6], ip6h->dst_addr, sizeof(dst_ips6[nb_fwd6]));
+            vrfs6[nb_fwd6] = vrf_idx;
+
+            nb_fwd6++;
+        }
+        else
+        {
+            // Make sure we're dealing with IPv4 or IPv6 (VLAN and QinQ tags were already skipped by the parser).
+            rte_pktmbuf_free(pckt);
+
+            stats_drop(st, DROP_UNSUPPORTED);
+        }
     }
 
-    // Handle VLAN.
-    if (eth->ether_type == htons(ETH_P_8021Q))
+    if (nb_fwd > 0)
     {
-        // VLAN header length is four bytes, so increase offset by that amount.
-        offset += 4;
-    }
+        // Decrement the TTLs and incrementally update the header checksums of the whole burst (packets without a route are dropped below anyways).
+        ipv4_ttl_dec_burst(iphs, nb_fwd);
 
-    // Initialize IPv4 header.
-    struct rte_ipv4_hdr *iph = data + offset;
+        if (nb_miss > 0)
+        {
+            // Store the VRFs first, the bulk lookup modifies them.
+            __u8 vrfs[nb_miss];
 
-    // Perform lookup on route table.
-    struct rte_ether_addr *dmac;
+            memcpy(vrfs, miss_vrfs, nb_miss);
 
-    int is_routable = rte_hash_lookup_data(route_tbl, &iph->dst_addr, (void **)&dmac);
+            // Perform one bulk lookup for all cache misses (per VRF) so the memory reads of each lookup overlap.
+            fib_lookup_bulk(fib, vrfs, miss_ips, miss_nhs, nb_miss);
 
-    // If we find no match, drop the packet.
-    if (is_routable < 0)
-    {
-        // Increment dropped packet counter.
-        pckts_dropped++;
+            for (i = 0; i < nb_miss; i++)
+            {
+                struct route_cache_entry *ce = route_cache_slot(cache, miss_ips[i], miss_vrfs[i]);
 
-        // Free the packet's mbuf and return.
-        rte_pktmbuf_free(pckt);
+                ce->dst = miss_ips[i];
+                ce->vrf = miss_vrfs[i];
+                ce->nh = (miss_nhs[i] < 0) ? ROUTE_CACHE_NO_ROUTE : (__u16)miss_nhs[i];
 
-        return;
+                nhs[miss_idx[i]] = miss_nhs[i];
+            }
+        }
+
+        // Second pass rewrites the burst.
+        for (i = 0; i < nb_fwd; i++)
+        {
+            __s32 nh = nhs[i];
+
+            // If we find no match and have no default route, drop the packet.
+            if (nh < 0)
+            {
+                drop_no_route(fwd[i], st);
+
+                continue;
+            }
+
+            // Only ECMP routes need the flow hash.
+            out_ports[nb_out] = fwd_to_next_hop(eths[i], port_id, fib_next_hop(fib, nh, (nh & NH_GROUP_FLAG) ? flow_hash_ipv4(fwd[i], iphs[i]) : 0));
+            out[nb_out++] = fwd[i];
+        }
     }
 
-    // Now copy the port we're going out from as the source MAC and the correct destination from the route lookup.
-    rte_ether_addr_copy(&ports[port_id].mac, &eth->src_addr);
-    rte_ether_addr_copy(dmac, &eth->dst_addr);
+    if (nb_fwd6 > 0)
+    {
+        // Same as above for IPv6.
+        fib_lookup6_bulk(fib, vrfs6, dst_ips6, nhs6, nb_fwd6);
 
-#ifdef DEBUG
-    printf("Packet forwarding from " RTE_ETHER_ADDR_PRT_FMT " => " RTE_ETHER_ADDR_PRT_FMT ".\n", RTE_ETHER_ADDR_BYTES(&eth->src_addr), RTE_ETHER_ADDR_BYTES(&eth->dst_addr));
-#endif
-    
-    // Otherwise, forward packet.
-    unsigned dst_port;
-    struct rte_eth_dev_tx_buffer *buffer;
-
-    // Retrieve what port we're going out of and TX buffer to use.
-    dst_port = ports[port_id].tx_port;
-    buffer = ports[dst_port].tx_buffer;
-    
-    rte_eth_tx_buffer(dst_port, 0, buffer, pckt);
-
-    // Increment packets TX count.
-    pckts_forwarded++;
+        for (i = 0; i < nb_fwd6; i++)
+        {
+            __s32 nh = nhs6[i];
+
+            if (nh < 0)
+            {
+                drop_no_route(fwd6[i], st);
+
+                continue;
+            }
+
+            out_ports[nb_out] = fwd_to_next_hop(eths6[i], port_id, fib_next_hop(fib, nh, (nh & NH_GROUP_FLAG) ? flow_hash_ipv6(fwd6[i], ip6hs[i]) : 0));
+            out[nb_out++] = fwd6[i];
+        }
+    }
+
+    if (nb_out > 0)
+    {
+        tx_by_port(out, out_ports, nb_out, qconf, st);
+    }
 }
 
 /**
@@ -223,38 +1450,48 @@ static void fwd_pckt(struct rte_mbuf *pckt, unsigned port_id, struct rte_hash *r
 static void pckt_loop(void)
 {
     // An array of packets witin burst.
-    struct rte_mbuf *pckts_burst[packet_burst_size];
+    struct rte_mbuf *pckts_burst[PARSE_MAX_BURST];
+
+    // The parsed headers of the burst.
+    struct parse_meta meta;
 
-    // Single mbuf we'll use to inspect.
-    struct rte_mbuf *pckt;
+    // The parser handles at most PARSE_MAX_BURST packets at once.
+    const unsigned burst_size = RTE_MIN(packet_burst_size, PARSE_MAX_BURST);
 
     // Retrieve the l-core ID.
     unsigned lcore_id = rte_lcore_id();
 
     // Iteration variables.
     unsigned i;
-    unsigned j;
 
     // the port ID and number of packets from RX queue.
     unsigned port_id;
     unsigned nb_rx;
 
-    // The specific RX queue config for the l-core.
-    struct lcore_port_conf *qconf = &lcore_port_conf[lcore_id];
+    // The specific RX/TX queue config for the l-core.
+    struct lcore_queue_conf *qconf = &lcore_queue_conf[lcore_id];
+
+    // The l-core's own counters.
+    struct lcore_stats *st = &lcore_stats[lcore_id];
+
+    // The l-core's own route cache (emptied on first use).
+    struct route_cache cache;
+
+    cache.generation = 0;
 
     // For TX draining.
     const __u64 draintsc = (rte_get_tsc_hz() + US_PER_S - 1) / US_PER_S * BURST_TX_DRAIN_US;
 
-    // Pointer to TX buffer.
-    struct rte_eth_dev_tx_buffer *buffer;
-
     // Create timer variables.
     __u64 prevtsc = 0;
     __u64 difftsc;
     __u64 curtsc;
 
+    // Whether to trust the NIC's packet types (hardware metadata mode).
+    const unsigned use_ptype = cmd.hwmeta;
+
     // If we have no RX ports under this l-core, return because the l-core has nothing else to do.
-    if (qconf->num_rx_ports == 0)
+    if (qconf->num_rx_queues == 0)
     {
         RTE_LOG(INFO, USER1, "lcore %u has nothing to do.\n", lcore_id);
 
@@ -262,19 +1499,18 @@ static void pckt_loop(void)
     }
 
     // Log message.
-    RTE_LOG(INFO, USER1, "Looping lcore %u with %u RX ports/queues.\n", lcore_id, qconf->num_rx_ports);
+    RTE_LOG(INFO, USER1, "Looping lcore %u with %u RX queues (TX queue %u).\n", lcore_id, qconf->num_rx_queues, qconf->tx_queue_id);
 
-    // Retreive route table.
-    void *route_tbl = rte_hash_find_existing("route_table");
-
-    if (route_tbl == NULL)
-    {
-        rte_exit(EXIT_FAILURE, "Failed to find routing table on port %d.\n", port_id);
-    }
+    // Register with the FIB's RCU variable so route reloads wait on us before freeing the old FIB.
+    rte_rcu_qsbr_thread_register(fib_rcu, lcore_id);
+    rte_rcu_qsbr_thread_online(fib_rcu, lcore_id);
 
     // Create while loop relying on quit variable.
     while (!quit)
     {
+        // Retrieve the current FIB. This is a single load, we never take a lock on the datapath.
+        const struct fib *fib = __atomic_load_n(&cur_fib, __ATOMIC_ACQUIRE);
+
         // Get current timestamp.
         curtsc = rte_rdtsc();
 
@@ -284,18 +1520,12 @@ static void pckt_loop(void)
         // Check if we need to send packets out the buffer.
         if (unlikely(difftsc > draintsc))
         {
-            // Loop through all TX ports.
+            // Loop through all TX ports and send packets in our own buffer out our own TX queue.
             for (i = 0; i < qconf->num_tx_ports; i++)
             {
-                // Retrieve correct port_id and buffer.
-                port_id = ports[qconf->rx_port_list[i]].tx_port;
-                buffer = ports[port_id].tx_buffer;
+                port_id = qconf->tx_port_list[i];
 
-                // Loop through each TX queue and send packets in buffer.
-                for (j = 0; j < tx_queue_pp; j++)
-                {
-                    rte_eth_tx_buffer_flush(port_id, j, buffer);
-                }
+                rte_eth_tx_buffer_flush(port_id, qconf->tx_queue_id, qconf->tx_buffers[port_id]);
             }
 
             // Assign prevtsc.
@@ -303,28 +1533,30 @@ static void pckt_loop(void)
         }
 
         // Read all packets from RX queue.
-        for (i = 0; i < qconf->num_rx_ports; i++)
+        for (i = 0; i < qconf->num_rx_queues; i++)
         {
             // Retrieve correct port ID.
-            port_id = qconf->rx_port_list[i];
+            port_id = qconf->rx_queues[i].port_id;
 
             // Burst RX which will assign nb_rx to the amount of packets we have from the RX queue.
-            nb_rx = rte_eth_rx_burst(port_id, 0, pckts_burst, packet_burst_size);
+            nb_rx = rte_eth_rx_burst(port_id, qconf->rx_queues[i].queue_id, pckts_burst, burst_size);
 
-            // Loop through the amount of packets we have from the RX queue.
-            for (j = 0; j < nb_rx; j++)
+            // Parse the headers of the whole burst and forward it.
+            if (nb_rx > 0)
             {
-                // Assign the individual packet mbuf.
-                pckt = pckts_burst[j];
+                parse_burst(pckts_burst, nb_rx, &meta, use_ptype);
 
-                // Prefetch the packet.
-                rte_prefetch0(rte_pktmbuf_mtod(pckt, void *));
-
-                // Lastly, forward the packet.
-                fwd_pckt(pckt, port_id, route_tbl);
+                fwd_burst(pckts_burst, &meta, port_id, qconf, st, &cache, fib);
             }
         }
+
+        // We no longer hold a reference to the FIB.
+        rte_rcu_qsbr_quiescent(fib_rcu, lcore_id);
     }
+
+    // Make sure reloads don't wait on us after we exit.
+    rte_rcu_qsbr_thread_offline(fib_rcu, lcore_id);
+    rte_rcu_qsbr_thread_unregister(fib_rcu, lcore_id);
 }
 
 /**
@@ -352,38 +1584,76 @@ static void sign_hdl(int tmp)
 }
 
 /**
- * The stats thread handler.
+ * The reload signal (SIGHUP) callback/handler.
  * 
  * @param tmp An unused variable.
  * 
  * @return Void
 **/
-void *hndl_stats(void *tmp)
+static void reload_hdl(int tmp)
 {
-    // Last updated variables.
-    __u64 last_fwd = 0;
-    __u64 last_drop = 0;
+    reload = 1;
+}
 
+/**
+ * The route reload thread handler. Builds a new FIB when a reload is requested, publishes it to the l-cores and frees the old FIB after all l-cores went through a quiescent state.
+ * 
+ * @param tmp An unused variable.
+ * 
+ * @return Void
+**/
+void *hndl_reload(void *tmp)
+{
     // Run until program exits.
     while (!quit)
     {
-        // Retrieve current PPS.
-        __u64 fwd_pps = pckts_forwarded - last_fwd;
-        __u64 drop_pps = pckts_dropped - last_drop;
+        if (!reload)
+        {
+            usleep(RELOAD_CHECK_US);
+
+            continue;
+        }
+
+        reload = 0;
+
+        struct fib *old = cur_fib;
+
+        // Build the new FIB off the datapath.
+        struct fib *fib = fib_create(ROUTES_FILE, ROUTES_SNAPSHOT, old->generation + 1, 0);
+
+        if (fib == NULL)
+        {
+            printf("WARNING - Failed to create new FIB, keeping the current routes.\n");
+
+            continue;
+        }
 
-        // Flush stdout and print stats.
-        fflush(stdout);
-        printf("\rForward => %llu. Drop => %llu.", fwd_pps, drop_pps);
+        // Publish the new FIB to the l-cores.
+        __atomic_store_n(&cur_fib, fib, __ATOMIC_RELEASE);
 
-        // Update last variables.
-        last_fwd = pckts_forwarded;
-        last_drop = pckts_dropped;
+        // Wait for every l-core to report a quiescent state so nothing references the old FIB anymore and free it.
+        rte_rcu_qsbr_synchronize(fib_rcu, RTE_QSBR_THRID_INVALID);
 
-        // Sleep for a second to avoid unnecessary CPU cycles.
-        sleep(1);
+        fib_free(old);
     }
 }
 
+#if RTE_VERSION >= RTE_VERSION_NUM(23, 11, 0, 0)
+/**
+ * The route reload thread's entry point for rte_thread_create_control(), which expects a function returning an exit code.
+ * 
+ * @param tmp An unused variable.
+ * 
+ * @return 0
+**/
+static uint32_t hndl_reload_ctrl(void *tmp)
+{
+    hndl_reload(tmp);
+
+    return 0;
+}
+#endif
+
 /**
  * The main function call.
  * 
@@ -413,9 +1683,9 @@ int main(int argc, char **argv)
     quit = 0;
     signal(SIGINT, sign_hdl);
     signal(SIGTERM, sign_hdl);
+    signal(SIGHUP, reload_hdl);
 
     // Parse application-specific arguments.
-    struct cmdline cmd = {0};
     parsecmdline(&cmd, argc, argv);
 
     // Retrieve amount of l-cores.
@@ -444,26 +1714,20 @@ int main(int argc, char **argv)
     // Populate our destination ports.
     dpdkc_populate_dst_ports();
 
-    // Initialize mbuf pool.
-    ret = dpdkc_create_mbuf();
-
-    dpdkc_check_ret(&ret);
-
-    // Initialize each port.
-    ret = dpdkc_ports_queues_init(cmd.promisc, 1, 1);
-
-    // Check for error and fail with it if there is.
-    dpdkc_check_ret(&ret);
-
-    // Initialize the port and l-core mappings.
-    ret = dpdkc_ports_queues_mapping();
-
-    dpdkc_check_ret(&ret);
+    // Initialize the mbuf pool and each port with the amount of RX/TX queues specified (RSS spreads flows across them).
+    int nb_ports = queues_ports_init(cmd.promisc, cmd.queues, cmd.hwmeta, 0);
 
     // Check for available ports.
-    ret = dpdkc_ports_available();
+    if (nb_ports <= 0)
+    {
+        rte_exit(EXIT_FAILURE, "Failed to initialize ports or all available ports are disabled (%d).\n", nb_ports);
+    }
 
-    dpdkc_check_ret(&ret);
+    // Map RX/TX queue N of each port to l-core N.
+    if (queues_lcores_init(cmd.queues) != 0)
+    {
+        rte_exit(EXIT_FAILURE, "Failed to map %u queues to l-cores (make sure there's at least one l-core per queue).\n", cmd.queues);
+    }
 
     // Check port link status for all ports.
     dpdkc_check_link_status();
@@ -476,34 +1740,36 @@ int main(int argc, char **argv)
         __u16 dstport;
     } ckey;
 
-    // Create hash table for route lookups.
-    struct rte_hash_parameters hparams =
-    {
-        .name = "route_table",
-        .entries = 1024,
-        .hash_func = rte_jhash,
-        .key_len = sizeof(__u32),
-        .reserved = 0,
-        .socket_id = rte_socket_id()
-    };
+    // Create the RCU variable the l-cores report their quiescent states to.
+    size_t rcusz = rte_rcu_qsbr_get_memsize(RTE_MAX_LCORE);
 
-    void *route_tbl = rte_hash_create(&hparams);
+    fib_rcu = rte_zmalloc("fib_rcu", rcusz, RTE_CACHE_LINE_SIZE);
 
-    if (route_tbl == NULL)
+    if (fib_rcu == NULL || rte_rcu_qsbr_init(fib_rcu, RTE_MAX_LCORE) != 0)
     {
-        rte_exit(EXIT_FAILURE, "Failed to create hash table.\n");
+        rte_exit(EXIT_FAILURE, "Failed to create FIB RCU variable.\n");
     }
 
-    // Now scan the route table and insert into the hash map.
-    int routes = scan_route_table_and_add("/etc/l3fwd/routes.txt", route_tbl);
+    // Create the initial FIB from the routes file.
+    cur_fib = fib_create(ROUTES_FILE, ROUTES_SNAPSHOT, 0, 1);
 
-    if (routes < 0)
+    if (cur_fib == NULL)
     {
-        printf("WARNING - Did not add any routes due to error opening routes file => /etc/l3fwd/routes.txt.\n");
+        rte_exit(EXIT_FAILURE, "Failed to create LPM table.\n");
     }
-    else
+
+    // Create a control thread that rebuilds the FIB when SIGHUP is received. Control threads run on the CPUs left over by the l-cores (a plain thread would inherit the main l-core's affinity), so building the FIB and waiting for the l-cores' quiescent states never takes time from a forwarding l-core.
+#if RTE_VERSION >= RTE_VERSION_NUM(23, 11, 0, 0)
+    rte_thread_t rpid;
+
+    if (rte_thread_create_control(&rpid, "l3fwd-reload", hndl_reload_ctrl, NULL) != 0)
+#else
+    pthread_t rpid;
+
+    if (rte_ctrl_thread_create(&rpid, "l3fwd-reload", NULL, hndl_reload, NULL) != 0)
+#endif
     {
-        printf("Added %u routes to table!\n", routes);
+        rte_exit(EXIT_FAILURE, "Failed to create the route reload thread.\n");
     }
 
     // If stats is enabled, create a separate thread that flushes stdout and prints stats.
@@ -511,7 +1777,7 @@ int main(int argc, char **argv)
     {
         pthread_t pid;
 
-        pthread_create(&pid, NULL, hndl_stats, NULL);
+        pthread_create(&pid, NULL, stats_hndl, NULL);
     }
 
     // Launch the application on each l-core.
@@ -527,7 +1793,7 @@ int main(int argc, char **argv)
 
     dpdkc_check_ret(&ret);
 
-    printf("Total Packets Forwarded => %llu.\nTotal Packets Dropped => %llu.\n\n", pckts_forwarded, pckts_dropped);
+    stats_print_totals();
 
     return 0;
 }
\ No newline at end of file
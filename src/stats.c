@@ -0,0 +1,136 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <dpdk_common.h>
+
+#include "stats.h"
+
+struct lcore_stats lcore_stats[RTE_MAX_LCORE];
+
+static const char *drop_reason_names[DROP_MAX] =
+{
+    [DROP_UNSUPPORTED] = "Unsupported",
+    [DROP_FILTER] = "Filter",
+    [DROP_NO_ROUTE] = "No Route",
+    [DROP_TTL] = "TTL Expired",
+    [DROP_RATE_LIMIT] = "Rate Limit",
+    [DROP_PREFIX_LIMIT] = "Prefix Limit",
+    [DROP_TX_FULL] = "TX Full"
+};
+
+/**
+ * Aggregates the stats blocks of all l-cores.
+ * 
+ * @param total A pointer to the stats block to store the totals in.
+ * 
+ * @return Void
+**/
+void stats_sum(struct lcore_stats *total)
+{
+    unsigned lcore_id;
+    unsigned i;
+
+    memset(total, 0, sizeof(*total));
+
+    for (lcore_id = 0; lcore_id < RTE_MAX_LCORE; lcore_id++)
+    {
+        const struct lcore_stats *st = &lcore_stats[lcore_id];
+
+        // The owning l-core may be writing at the same time, but aligned 64-bit loads are never torn.
+        total->forwarded += __atomic_load_n(&st->forwarded, __ATOMIC_RELAXED);
+
+        for (i = 0; i < DROP_MAX; i++)
+        {
+            total->dropped[i] += __atomic_load_n(&st->dropped[i], __ATOMIC_RELAXED);
+        }
+
+        total->untracked += __atomic_load_n(&st->untracked, __ATOMIC_RELAXED);
+    }
+}
+
+/**
+ * Retrieves the total of all drop reasons within a stats block.
+ * 
+ * @param st A pointer to the stats block.
+ * 
+ * @return The total dropped packets.
+**/
+__u64 stats_total_dropped(const struct lcore_stats *st)
+{
+    __u64 total = 0;
+    unsigned i;
+
+    for (i = 0; i < DROP_MAX; i++)
+    {
+        total += st->dropped[i];
+    }
+
+    return total;
+}
+
+/**
+ * The stats thread handler.
+ * 
+ * @param tmp An unused variable.
+ * 
+ * @return Void
+**/
+void *stats_hndl(void *tmp)
+{
+    // Last updated variables.
+    struct lcore_stats last = {0};
+    struct lcore_stats cur;
+
+    // Run until program exits.
+    while (!quit)
+    {
+        stats_sum(&cur);
+
+        // Retrieve current PPS.
+        __u64 fwd_pps = cur.forwarded - last.forwarded;
+        __u64 drop_pps = stats_total_dropped(&cur) - stats_total_dropped(&last);
+
+        // Flush stdout and print stats.
+        fflush(stdout);
+        printf("\rForward => %llu. Drop => %llu.", fwd_pps, drop_pps);
+
+        // Update last variables.
+        last = cur;
+
+        // Sleep for a second to avoid unnecessary CPU cycles.
+        sleep(1);
+    }
+
+    return NULL;
+}
+
+/**
+ * Prints the total packet counters along with the drop reason breakdown.
+ * 
+ * @return Void
+**/
+void stats_print_totals(void)
+{
+    struct lcore_stats total;
+    unsigned i;
+
+    stats_sum(&total);
+
+    printf("Total Packets Forwarded => %llu.\nTotal Packets Dropped => %llu.\n", total.forwarded, stats_total_dropped(&total));
+
+    for (i = 0; i < DROP_MAX; i++)
+    {
+        if (total.dropped[i] > 0)
+        {
+            printf("    %s => %llu.\n", drop_reason_names[i], total.dropped[i]);
+        }
+    }
+
+    if (total.untracked > 0)
+    {
+        printf("Total Packets Forwarded Untracked (Table Full) => %llu.\n", total.untracked);
+    }
+
+    printf("\n");
+}
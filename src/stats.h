@@ -0,0 +1,87 @@
+#ifndef STATS_HEADER
+#define STATS_HEADER
+
+#include <linux/types.h>
+
+#include <rte_common.h>
+#include <rte_lcore.h>
+
+enum drop_reason
+{
+    DROP_UNSUPPORTED = 0,
+    DROP_FILTER,
+    DROP_NO_ROUTE,
+    DROP_TTL,
+    DROP_RATE_LIMIT,
+    DROP_PREFIX_LIMIT,
+    DROP_TX_FULL,
+    DROP_MAX
+};
+
+// Each l-core only ever writes its own block, so keep each block on its own cache line(s) to prevent false sharing.
+struct lcore_stats
+{
+    __u64 forwarded;
+    __u64 dropped[DROP_MAX];
+
+    // Packets of sources the rate limit table had no room for, which are forwarded without tracking them.
+    __u64 untracked;
+} __rte_cache_aligned;
+
+extern struct lcore_stats lcore_stats[RTE_MAX_LCORE];
+
+/**
+ * Increments the forwarded counter of an l-core's stats block.
+ * 
+ * @param st A pointer to the l-core's stats block.
+ * 
+ * @return Void
+**/
+static inline void stats_fwd(struct lcore_stats *st)
+{
+    st->forwarded++;
+}
+
+/**
+ * Adds a whole burst of packets to the forwarded counter of an l-core's stats block.
+ * 
+ * @param st A pointer to the l-core's stats block.
+ * @param nb The amount of packets forwarded.
+ * 
+ * @return Void
+**/
+static inline void stats_fwd_bulk(struct lcore_stats *st, unsigned nb)
+{
+    st->forwarded += nb;
+}
+
+/**
+ * Increments the untracked counter of an l-core's stats block.
+ * 
+ * @param st A pointer to the l-core's stats block.
+ * 
+ * @return Void
+**/
+static inline void stats_untracked(struct lcore_stats *st)
+{
+    st->untracked++;
+}
+
+/**
+ * Increments a drop reason counter of an l-core's stats block.
+ * 
+ * @param st A pointer to the l-core's stats block.
+ * @param reason The drop reason.
+ * 
+ * @return Void
+**/
+static inline void stats_drop(struct lcore_stats *st, enum drop_reason reason)
+{
+    st->dropped[reason]++;
+}
+
+void stats_sum(struct lcore_stats *total);
+__u64 stats_total_dropped(const struct lcore_stats *st);
+void *stats_hndl(void *tmp);
+void stats_print_totals(void);
+#endif